@@ -0,0 +1,98 @@
+#include <iostream>
+#include <vector>
+
+#include <emscripten.h>
+
+#include "fake_usb.h"
+
+extern "C" {
+#include "libusb_webusb.h"
+}
+
+// Bulk IN auto-tuning against the scripted fake device. The application keeps
+// a fixed set of large transfers in flight, as hackrf_start_rx() does, and the
+// operating point picked by the tuner is printed as it converges for two
+// different per-call latencies.
+
+#define XFER_LEN        (256 * 1024)
+#define XFERS           8
+#define RUN_MS          8000.0
+#define REPORT_MS       500.0
+#define BANDWIDTH_KBPS  40000
+
+static bool running = false;
+static int outstanding = 0;
+
+static void LIBUSB_CALL callback(struct libusb_transfer *transfer) {
+    outstanding--;
+
+    if (running && libusb_submit_transfer(transfer) == 0)
+        outstanding++;
+}
+
+static void run(libusb_context *ctx, libusb_device_handle *handle, int latency_us) {
+    std::vector<struct libusb_transfer*> xfers;
+
+    fake_usb_configure(handle, latency_us, BANDWIDTH_KBPS);
+    libusb_webusb_set_autotune(handle, FAKE_USB_EP_IN, 1);
+
+    std::cout << latency_us << " us per call" << std::endl;
+
+    for (int i = 0; i < XFERS; i++) {
+        struct libusb_transfer *t = libusb_alloc_transfer(0);
+        unsigned char *buf = libusb_dev_mem_alloc(handle, XFER_LEN);
+        libusb_fill_bulk_transfer(t, handle, FAKE_USB_EP_IN, buf, XFER_LEN, callback, nullptr, 0);
+        xfers.push_back(t);
+    }
+
+    running = true;
+    for (auto t : xfers) {
+        if (libusb_submit_transfer(t) == 0)
+            outstanding++;
+    }
+
+    double start = emscripten_get_now();
+    double next = start + REPORT_MS;
+    while (emscripten_get_now() - start < RUN_MS) {
+        libusb_handle_events(ctx);
+
+        if (emscripten_get_now() < next)
+            continue;
+        next += REPORT_MS;
+
+        struct libusb_webusb_tuning tuning;
+        libusb_webusb_get_tuning(handle, FAKE_USB_EP_IN, &tuning);
+        std::cout << "  " << (int)(emscripten_get_now() - start) << " ms: "
+                  << tuning.split_size << " bytes x " << tuning.depth << ", "
+                  << tuning.throughput / 1e6 << " MB/s, "
+                  << tuning.latency_us << " us latency"
+                  << (tuning.settled ? ", settled" : "") << std::endl;
+    }
+
+    running = false;
+    while (outstanding > 0)
+        libusb_handle_events(ctx);
+
+    for (auto t : xfers) {
+        libusb_dev_mem_free(handle, t->buffer, XFER_LEN);
+        libusb_free_transfer(t);
+    }
+
+    libusb_webusb_set_autotune(handle, FAKE_USB_EP_IN, 0);
+}
+
+int main() {
+    libusb_context *ctx;
+    libusb_device_handle *handle;
+
+    if (fake_usb_open(&ctx, &handle) < 0)
+        return 1;
+
+    run(ctx, handle, 500);
+    run(ctx, handle, 8000);
+
+    libusb_close(handle);
+    libusb_exit(ctx);
+
+    return 0;
+}
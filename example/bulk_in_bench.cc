@@ -0,0 +1,139 @@
+#include <iostream>
+#include <vector>
+
+#include <emscripten.h>
+
+#include "fake_usb.h"
+
+extern "C" {
+#include "libusb_webusb.h"
+}
+
+// Bulk IN throughput against the scripted fake device for growing numbers of
+// transfers in flight. Every completed transfer is resubmitted right away,
+// either from the callback as airspy_start_rx() and hackrf_start_rx() do, by
+// the library with LIBUSB_WEBUSB_TRANSFER_AUTO_RESUBMIT, or all at once from
+// a batch callback.
+
+#define XFER_LEN        (16 * 1024)
+#define RUN_MS          2000.0
+#define LATENCY_US      2000
+#define BANDWIDTH_KBPS  40000
+
+static bool running = false;
+static uint64_t received = 0;
+static int outstanding = 0;
+
+static void LIBUSB_CALL callback(struct libusb_transfer *transfer) {
+    outstanding--;
+
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        std::cerr << "transfer failed: " << transfer->status << std::endl;
+        return;
+    }
+
+    received += transfer->actual_length;
+
+    if (transfer->flags & LIBUSB_WEBUSB_TRANSFER_AUTO_RESUBMIT) {
+        if (running)
+            outstanding++;
+        else
+            transfer->flags &= ~LIBUSB_WEBUSB_TRANSFER_AUTO_RESUBMIT;
+        return;
+    }
+
+    if (running && libusb_submit_transfer(transfer) == 0)
+        outstanding++;
+}
+
+static void LIBUSB_CALL batch_callback(struct libusb_transfer **transfers, int count, void *user_data) {
+    std::vector<struct libusb_transfer*> resubmit;
+
+    for (int i = 0; i < count; i++) {
+        outstanding--;
+
+        if (transfers[i]->status != LIBUSB_TRANSFER_COMPLETED) {
+            std::cerr << "transfer failed: " << transfers[i]->status << std::endl;
+            continue;
+        }
+
+        received += transfers[i]->actual_length;
+        resubmit.push_back(transfers[i]);
+    }
+
+    if (running && !resubmit.empty()) {
+        int r = libusb_webusb_submit_transfers(resubmit.data(), resubmit.size());
+        if (r > 0)
+            outstanding += r;
+    }
+}
+
+static double run(libusb_context *ctx, libusb_device_handle *handle, int depth, uint8_t flags, bool batch = false) {
+    std::vector<struct libusb_transfer*> xfers;
+    std::vector<unsigned char*> bufs;
+
+    for (int i = 0; i < depth; i++) {
+        struct libusb_transfer *t = libusb_alloc_transfer(0);
+        unsigned char *buf = (unsigned char*)malloc(XFER_LEN);
+        libusb_fill_bulk_transfer(t, handle, FAKE_USB_EP_IN, buf, XFER_LEN, callback, nullptr, 0);
+        t->flags = flags;
+        xfers.push_back(t);
+        bufs.push_back(buf);
+    }
+
+    libusb_webusb_set_batch_callback(handle, FAKE_USB_EP_IN, batch ? batch_callback : nullptr, nullptr);
+
+    running = true;
+    received = 0;
+    outstanding = 0;
+
+    double start = emscripten_get_now();
+    for (auto t : xfers) {
+        if (libusb_submit_transfer(t) == 0)
+            outstanding++;
+    }
+
+    while (emscripten_get_now() - start < RUN_MS)
+        libusb_handle_events(ctx);
+
+    double elapsed = emscripten_get_now() - start;
+    uint64_t bytes = received;
+
+    running = false;
+    while (outstanding > 0)
+        libusb_handle_events(ctx);
+
+    for (int i = 0; i < depth; i++) {
+        libusb_free_transfer(xfers[i]);
+        free(bufs[i]);
+    }
+
+    return bytes / elapsed / 1000.0;
+}
+
+int main() {
+    libusb_context *ctx;
+    libusb_device_handle *handle;
+
+    if (fake_usb_open(&ctx, &handle) < 0)
+        return 1;
+
+    fake_usb_configure(handle, LATENCY_US, BANDWIDTH_KBPS);
+
+    std::cout << "bulk IN, " << XFER_LEN << " byte transfers, "
+              << LATENCY_US << " us per call, "
+              << BANDWIDTH_KBPS / 1000 << " MB/s bus" << std::endl;
+
+    for (int depth = 1; depth <= 32; depth *= 2) {
+        std::cout << "depth " << depth << ": "
+                  << run(ctx, handle, depth, 0) << " MB/s resubmitting, "
+                  << run(ctx, handle, depth, LIBUSB_WEBUSB_TRANSFER_AUTO_RESUBMIT) << " MB/s auto-resubmit, "
+                  << run(ctx, handle, depth, 0, true) << " MB/s batched"
+                  << std::endl;
+    }
+
+    libusb_close(handle);
+    libusb_exit(ctx);
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <emscripten.h>
+
+#include "fake_usb.h"
+
+extern "C" {
+#include "libusb_webusb.h"
+}
+
+// Bulk IN throughput with a callback that takes a while, as one that unpacks
+// samples does, with callbacks on the WebUSB worker and on a callback
+// thread. The callback stats show how long completions waited for their
+// callback and how much worker time the callbacks took.
+
+#define XFER_LEN        (64 * 1024)
+#define XFERS           16
+#define RUN_MS          3000.0
+#define LATENCY_US      1000
+#define BANDWIDTH_KBPS  40000
+#define CALLBACK_US     1000
+
+static _Atomic bool running = false;
+static _Atomic uint64_t received = 0;
+static _Atomic int outstanding = 0;
+
+static void LIBUSB_CALL callback(struct libusb_transfer *transfer) {
+    double end = emscripten_get_now() + CALLBACK_US / 1000.0;
+    while (emscripten_get_now() < end);
+
+    outstanding--;
+
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED)
+        return;
+
+    received += transfer->actual_length;
+
+    if (running && libusb_submit_transfer(transfer) == 0)
+        outstanding++;
+}
+
+static void run(libusb_context *ctx, libusb_device_handle *handle) {
+    std::vector<struct libusb_transfer*> xfers;
+
+    for (int i = 0; i < XFERS; i++) {
+        struct libusb_transfer *t = libusb_alloc_transfer(0);
+        unsigned char *buf = libusb_dev_mem_alloc(handle, XFER_LEN);
+        libusb_fill_bulk_transfer(t, handle, FAKE_USB_EP_IN, buf, XFER_LEN, callback, nullptr, 0);
+        xfers.push_back(t);
+    }
+
+    struct libusb_webusb_callback_stats before, after;
+    libusb_webusb_get_callback_stats(ctx, &before);
+
+    running = true;
+    received = 0;
+
+    double start = emscripten_get_now();
+    for (auto t : xfers) {
+        if (libusb_submit_transfer(t) == 0)
+            outstanding++;
+    }
+
+    while (emscripten_get_now() - start < RUN_MS)
+        libusb_handle_events(ctx);
+
+    double elapsed = emscripten_get_now() - start;
+    uint64_t bytes = received;
+
+    running = false;
+    while (outstanding > 0)
+        libusb_handle_events(ctx);
+
+    libusb_webusb_get_callback_stats(ctx, &after);
+
+    for (auto t : xfers) {
+        libusb_dev_mem_free(t->dev_handle, t->buffer, XFER_LEN);
+        libusb_free_transfer(t);
+    }
+
+    uint64_t callbacks = after.callbacks - before.callbacks;
+    std::cout << "  " << bytes / elapsed / 1000.0 << " MB/s, "
+              << (after.latency_us - before.latency_us) / std::max(callbacks, (uint64_t)1)
+              << " us average callback latency, "
+              << (after.worker_callback_us - before.worker_callback_us) / (elapsed * 10.0)
+              << " % of worker time in callbacks" << std::endl;
+}
+
+int main() {
+    libusb_context *ctx;
+    libusb_device_handle *handle;
+
+    if (fake_usb_open(&ctx, &handle) < 0)
+        return 1;
+
+    fake_usb_configure(handle, LATENCY_US, BANDWIDTH_KBPS);
+
+    std::cout << "bulk IN, " << XFER_LEN << " byte transfers, "
+              << CALLBACK_US << " us per callback" << std::endl;
+
+    std::cout << "callbacks on the worker:" << std::endl;
+    run(ctx, handle);
+
+    libusb_webusb_set_callback_thread(ctx, 1);
+    std::cout << "callbacks on a callback thread:" << std::endl;
+    run(ctx, handle);
+
+    libusb_close(handle);
+    libusb_exit(ctx);
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <vector>
+
+#include <emscripten.h>
+
+#include "fake_usb.h"
+
+extern "C" {
+#include "libusb_webusb.h"
+}
+
+// Device open and retune latency against the scripted fake device, with one
+// libusb_control_transfer() per register write versus a single
+// libusb_webusb_control_batch(). The request counts are in the range an
+// RTL-SDR or HackRF sends for the two operations.
+
+#define OPEN_WRITES     120
+#define RETUNE_WRITES   24
+#define ROUNDS          5
+#define LATENCY_US      1000
+
+#define VENDOR_OUT  (LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE)
+
+static unsigned char reg[2];
+
+static double sequential(libusb_device_handle *handle, int writes) {
+    double start = emscripten_get_now();
+    for (int i = 0; i < writes; i++)
+        libusb_control_transfer(handle, VENDOR_OUT, 0x01, i, 0x10, reg, sizeof(reg), 0);
+    return emscripten_get_now() - start;
+}
+
+static double batched(libusb_device_handle *handle, int writes) {
+    std::vector<struct libusb_webusb_control_request> requests(writes);
+    for (int i = 0; i < writes; i++) {
+        requests[i] = {};
+        requests[i].bmRequestType = VENDOR_OUT;
+        requests[i].bRequest = 0x01;
+        requests[i].wValue = i;
+        requests[i].wIndex = 0x10;
+        requests[i].wLength = sizeof(reg);
+        requests[i].data = reg;
+    }
+
+    double start = emscripten_get_now();
+    libusb_webusb_control_batch(handle, requests.data(), writes);
+    return emscripten_get_now() - start;
+}
+
+static void report(const char* name, libusb_device_handle *handle, int writes) {
+    double seq = 0, batch = 0;
+
+    for (int i = 0; i < ROUNDS; i++) {
+        seq += sequential(handle, writes);
+        batch += batched(handle, writes);
+    }
+
+    std::cout << name << " (" << writes << " writes): "
+              << seq / ROUNDS << " ms sequential, "
+              << batch / ROUNDS << " ms batched" << std::endl;
+}
+
+int main() {
+    libusb_context *ctx;
+    libusb_device_handle *handle;
+
+    if (fake_usb_open(&ctx, &handle) < 0)
+        return 1;
+
+    fake_usb_configure(handle, LATENCY_US, 40000);
+
+    report("open", handle, OPEN_WRITES);
+    report("retune", handle, RETUNE_WRITES);
+
+    libusb_close(handle);
+    libusb_exit(ctx);
+
+    return 0;
+}
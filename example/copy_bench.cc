@@ -0,0 +1,58 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include <emscripten.h>
+#include <emscripten/val.h>
+
+using namespace emscripten;
+
+// Bytes per second of the two ways of landing a WebUSB result DataView in
+// wasm memory, on synthetic 256 KiB transfers:
+//
+//   string: data.buffer marshalled to std::string, then std::copy.
+//   set:    one Uint8Array.set() from the view straight into the heap.
+
+#define XFER_LEN    (256 * 1024)
+#define ITERATIONS  500
+
+static unsigned char dst[XFER_LEN];
+
+static int copy_string(val data, unsigned char* buffer, int size) {
+    auto buf = data["buffer"].as<std::string>();
+    int len = std::min((int)buf.size(), size);
+    std::copy(buf.begin(), buf.begin() + len, buffer);
+    return len;
+}
+
+static int copy_set(val data, unsigned char* buffer, int size) {
+    int len = std::min(data["byteLength"].as<int>(), size);
+    val src = val::global("Uint8Array").new_(data["buffer"], data["byteOffset"], len);
+    val(typed_memory_view(len, buffer)).call<void>("set", src);
+    return len;
+}
+
+template<typename F>
+static void run(const char* name, val data, F copy) {
+    uint64_t bytes = 0;
+
+    double start = emscripten_get_now();
+    for (int i = 0; i < ITERATIONS; i++)
+        bytes += copy(data, dst, XFER_LEN);
+    double elapsed = emscripten_get_now() - start;
+
+    std::cout << name << ": " << bytes / elapsed / 1000.0 << " MB/s, "
+              << elapsed * 1000.0 / ITERATIONS << " us per transfer" << std::endl;
+}
+
+int main() {
+    val buffer = val::global("ArrayBuffer").new_(XFER_LEN);
+    val data = val::global("DataView").new_(buffer);
+
+    std::cout << "completion copy, " << XFER_LEN << " byte transfers" << std::endl;
+
+    run("string", data, copy_string);
+    run("set", data, copy_set);
+
+    return 0;
+}
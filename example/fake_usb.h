@@ -0,0 +1,62 @@
+#ifndef FAKE_USB_H
+#define FAKE_USB_H
+
+// Helpers for the benchmark examples that run against example/fake_usb.js.
+
+#include <iostream>
+#include <stdint.h>
+
+extern "C" {
+#include "libusb.h"
+}
+
+#define FAKE_USB_CONFIGURE  0xf0
+#define FAKE_USB_EP_IN      (LIBUSB_ENDPOINT_IN | 1)
+#define FAKE_USB_EP_OUT     (LIBUSB_ENDPOINT_OUT | 2)
+#define FAKE_USB_EP_INT     (LIBUSB_ENDPOINT_IN | 3)
+#define FAKE_USB_EP_ISO_IN  (LIBUSB_ENDPOINT_IN | 4)
+#define FAKE_USB_EP_ISO_OUT (LIBUSB_ENDPOINT_OUT | 5)
+#define FAKE_USB_ISO_PACKET 1024
+
+static inline int fake_usb_configure(libusb_device_handle *handle,
+        uint32_t latency_us, uint32_t bandwidth_kBps, uint32_t cpu_us = 0) {
+    uint32_t cfg[3] = { latency_us, bandwidth_kBps, cpu_us };
+    int r = libusb_control_transfer(handle,
+            LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
+            FAKE_USB_CONFIGURE, 0, 0, (unsigned char*)cfg, sizeof(cfg), 0);
+    return r < 0 ? r : 0;
+}
+
+// Open and claim the index-th fake device on an initialized context.
+static inline int fake_usb_open_device(libusb_context *ctx, int index, libusb_device_handle **handle) {
+    libusb_device **list;
+    if (libusb_get_device_list(ctx, &list) <= index) {
+        std::cerr << "Error libusb_get_device_list()." << std::endl;
+        return -1;
+    }
+
+    if (libusb_open(list[index], handle) < 0) {
+        std::cerr << "Error libusb_open()." << std::endl;
+        return -1;
+    }
+
+    libusb_free_device_list(list, 1);
+
+    if (libusb_claim_interface(*handle, 0) < 0) {
+        std::cerr << "Error libusb_claim_interface()." << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline int fake_usb_open(libusb_context **ctx, libusb_device_handle **handle) {
+    if (libusb_init(ctx) < 0) {
+        std::cerr << "Error libusb_init()." << std::endl;
+        return -1;
+    }
+
+    return fake_usb_open_device(*ctx, 0, handle);
+}
+
+#endif
@@ -0,0 +1,192 @@
+// Scripted stand-in for navigator.usb, used by the benchmark examples.
+//
+// Linked with --pre-js, so every thread (main and WebUSB workers) gets its
+// own instance. Transfers complete after a fixed per-call latency plus the
+// time a shared bus of limited bandwidth needs to move the data, which is
+// enough to show how pipelining and batching change throughput and latency.
+//
+// The timing model is configured over USB itself with a vendor control OUT
+// request, so a benchmark reaches the instance owned by its WebUSB worker:
+//
+//   bRequest = 0xf0, data = { uint32 latency_us, uint32 bandwidth_kBps,
+//                             uint32 cpu_us (optional) }
+//
+// cpu_us is thread time spent on every completion, standing in for the
+// browser's own per-transfer work on the thread that owns the device.
+//
+// Every ISO_MISS_EVERY-th isochronous IN packet is missed and comes back
+// without data, as packets the host controller could not schedule do.
+//
+// Like Chrome, OUT transfers reject views of shared memory with a TypeError,
+// so the library's copy fallback runs with several transfers in flight.
+//
+// Two identical devices are listed; requestDevice() picks the first.
+
+(function() {
+    if (typeof navigator === 'undefined')
+        return;
+
+    var FAKE_USB_CONFIGURE = 0xf0;
+    var ISO_MISS_EVERY = 64;
+
+    function FakeUSBDevice(serial) {
+        this.vendorId = 0x1d50;
+        this.productId = 0x6089;
+        this.productName = 'Fake SDR';
+        this.manufacturerName = 'webusb-libusb';
+        this.serialNumber = ('000000000000000' + serial).slice(-16);
+        this.usbVersionMajor = 2;
+        this.usbVersionMinor = 0;
+        this.deviceClass = 0;
+        this.deviceSubclass = 0;
+        this.deviceProtocol = 0;
+        this.deviceVersionMajor = 1;
+        this.deviceVersionMinor = 0;
+        this.deviceVersionSubminor = 0;
+        this.configurations = [{
+            configurationValue: 1,
+            configurationName: 'Fake',
+            interfaces: [{
+                interfaceNumber: 0,
+                claimed: false,
+                alternates: [{
+                    alternateSetting: 0,
+                    interfaceClass: 0xff,
+                    interfaceSubclass: 0xff,
+                    interfaceProtocol: 0xff,
+                    interfaceName: 'Fake',
+                    endpoints: [
+                        { endpointNumber: 1, direction: 'in', type: 'bulk', packetSize: 512 },
+                        { endpointNumber: 2, direction: 'out', type: 'bulk', packetSize: 512 },
+                        { endpointNumber: 3, direction: 'in', type: 'interrupt', packetSize: 64 },
+                        { endpointNumber: 4, direction: 'in', type: 'isochronous', packetSize: 1024 },
+                        { endpointNumber: 5, direction: 'out', type: 'isochronous', packetSize: 1024 }
+                    ]
+                }]
+            }]
+        }];
+        this.configuration = this.configurations[0];
+        this.opened = false;
+
+        this.latency = 1.0;         // ms per call
+        this.bandwidth = 40000;     // bytes per ms
+        this.cpu = 0;               // ms of thread time per completion
+        this.busFree = 0;
+        this.calls = 0;
+        this.isoPackets = 0;
+    }
+
+    FakeUSBDevice.prototype._complete = function(bytes, result) {
+        var now = performance.now();
+        var done = Math.max(now + this.latency, this.busFree) + bytes / this.bandwidth;
+        this.busFree = done;
+        this.calls++;
+        var cpu = this.cpu;
+        return new Promise(function(resolve) {
+            setTimeout(function() {
+                var end = performance.now() + cpu;
+                while (performance.now() < end);
+                resolve(result());
+            }, done - now);
+        });
+    };
+
+    FakeUSBDevice.prototype._ok = function() {
+        return Promise.resolve();
+    };
+
+    function sharedView(data) {
+        return !!data && typeof SharedArrayBuffer !== 'undefined' && data.buffer instanceof SharedArrayBuffer;
+    }
+
+    function rejectShared() {
+        return Promise.reject(new TypeError('The provided ArrayBufferView value must not be shared.'));
+    }
+
+    FakeUSBDevice.prototype.open = function() { this.opened = true; return this._ok(); };
+    FakeUSBDevice.prototype.close = function() { this.opened = false; return this._ok(); };
+    FakeUSBDevice.prototype.reset = FakeUSBDevice.prototype._ok;
+    FakeUSBDevice.prototype.selectConfiguration = FakeUSBDevice.prototype._ok;
+    FakeUSBDevice.prototype.claimInterface = FakeUSBDevice.prototype._ok;
+    FakeUSBDevice.prototype.releaseInterface = FakeUSBDevice.prototype._ok;
+    FakeUSBDevice.prototype.selectAlternateInterface = FakeUSBDevice.prototype._ok;
+    FakeUSBDevice.prototype.clearHalt = FakeUSBDevice.prototype._ok;
+
+    FakeUSBDevice.prototype.controlTransferIn = function(setup, length) {
+        return this._complete(length, function() {
+            return { status: 'ok', data: new DataView(new ArrayBuffer(length)) };
+        });
+    };
+
+    FakeUSBDevice.prototype.controlTransferOut = function(setup, data) {
+        if (sharedView(data))
+            return rejectShared();
+        var length = data ? data.byteLength : 0;
+        if (setup.requestType === 'vendor' && setup.request === FAKE_USB_CONFIGURE && length >= 8) {
+            var view = new DataView(data.buffer, data.byteOffset, data.byteLength);
+            this.latency = view.getUint32(0, true) / 1000;
+            this.bandwidth = Math.max(1, view.getUint32(4, true));
+            this.cpu = length >= 12 ? view.getUint32(8, true) / 1000 : 0;
+            return Promise.resolve({ status: 'ok', bytesWritten: length });
+        }
+        return this._complete(length, function() {
+            return { status: 'ok', bytesWritten: length };
+        });
+    };
+
+    FakeUSBDevice.prototype.transferIn = function(endpointNumber, length) {
+        return this._complete(length, function() {
+            return { status: 'ok', data: new DataView(new ArrayBuffer(length)) };
+        });
+    };
+
+    FakeUSBDevice.prototype.transferOut = function(endpointNumber, data) {
+        if (sharedView(data))
+            return rejectShared();
+        var length = data.byteLength;
+        return this._complete(length, function() {
+            return { status: 'ok', bytesWritten: length };
+        });
+    };
+
+    function sum(lengths) {
+        return lengths.reduce(function(a, b) { return a + b; }, 0);
+    }
+
+    FakeUSBDevice.prototype.isochronousTransferIn = function(endpointNumber, packetLengths) {
+        var self = this;
+        var length = sum(packetLengths);
+        return this._complete(length, function() {
+            var buffer = new ArrayBuffer(length);
+            var offset = 0;
+            var packets = packetLengths.map(function(len) {
+                var missed = ++self.isoPackets % ISO_MISS_EVERY == 0;
+                var packet = { status: 'ok', data: missed ? null : new DataView(buffer, offset, len) };
+                offset += len;
+                return packet;
+            });
+            return { data: new DataView(buffer), packets: packets };
+        });
+    };
+
+    FakeUSBDevice.prototype.isochronousTransferOut = function(endpointNumber, data, packetLengths) {
+        if (sharedView(data))
+            return rejectShared();
+        return this._complete(data.byteLength, function() {
+            return {
+                packets: packetLengths.map(function(len) {
+                    return { status: 'ok', bytesWritten: len };
+                })
+            };
+        });
+    };
+
+    var devices = [new FakeUSBDevice(1), new FakeUSBDevice(2)];
+
+    var usb = {
+        requestDevice: function() { return Promise.resolve(devices[0]); },
+        getDevices: function() { return Promise.resolve(devices.slice()); }
+    };
+
+    Object.defineProperty(navigator, 'usb', { value: usb, configurable: true });
+})();
@@ -0,0 +1,69 @@
+#include <iostream>
+#include <vector>
+
+#include <emscripten.h>
+
+#include "fake_usb.h"
+
+// Cost of one libusb_handle_events call with many transfers in flight and
+// nothing completing. The fake device is made slow enough that no transfer
+// finishes while the calls are timed.
+
+#define XFER_LEN    512
+#define CALLS       2000
+#define LATENCY_US  60000000
+
+static int outstanding = 0;
+
+static void LIBUSB_CALL callback(struct libusb_transfer *transfer) {
+    outstanding--;
+}
+
+static double run(libusb_context *ctx, libusb_device_handle *handle, int depth) {
+    static unsigned char buf[XFER_LEN];
+    std::vector<struct libusb_transfer*> xfers;
+
+    for (int i = 0; i < depth; i++) {
+        struct libusb_transfer *t = libusb_alloc_transfer(0);
+        libusb_fill_bulk_transfer(t, handle, FAKE_USB_EP_IN, buf, XFER_LEN, callback, nullptr, 0);
+        if (libusb_submit_transfer(t) == 0)
+            outstanding++;
+        xfers.push_back(t);
+    }
+
+    struct timeval tv = { 0, 0 };
+
+    double start = emscripten_get_now();
+    for (int i = 0; i < CALLS; i++)
+        libusb_handle_events_timeout_completed(ctx, &tv, nullptr);
+    double elapsed = emscripten_get_now() - start;
+
+    for (auto t : xfers)
+        libusb_cancel_transfer(t);
+    while (outstanding > 0)
+        libusb_handle_events_timeout_completed(ctx, &tv, nullptr);
+    for (auto t : xfers)
+        libusb_free_transfer(t);
+
+    return elapsed * 1000.0 / CALLS;
+}
+
+int main() {
+    libusb_context *ctx;
+    libusb_device_handle *handle;
+
+    if (fake_usb_open(&ctx, &handle) < 0)
+        return 1;
+
+    fake_usb_configure(handle, LATENCY_US, 40000);
+
+    for (int depth : { 0, 64, 256 }) {
+        std::cout << depth << " transfers in flight: "
+                  << run(ctx, handle, depth) << " us per handle_events" << std::endl;
+    }
+
+    libusb_close(handle);
+    libusb_exit(ctx);
+
+    return 0;
+}
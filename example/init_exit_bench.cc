@@ -0,0 +1,90 @@
+#include <iostream>
+
+#include <malloc.h>
+#include <emscripten.h>
+
+#include "fake_usb.h"
+
+extern "C" {
+#include "libusb_webusb.h"
+}
+
+// Repeated libusb_init/libusb_exit cycles, each opening a device and exiting
+// with transfers still in flight. Every context has its own worker, which
+// libusb_exit joins, so the heap in use should stay flat across cycles.
+// libusb_webusb_get_init_timing() splits the cost of libusb_init into worker
+// startup and the rest.
+
+#define CYCLES          50
+#define XFER_LEN        (16 * 1024)
+#define XFERS           8
+#define LATENCY_US      5000
+
+static uint64_t worker_start_us = 0;
+static uint64_t init_us = 0;
+
+static void LIBUSB_CALL callback(struct libusb_transfer *transfer) {
+}
+
+static size_t heap_in_use() {
+    return mallinfo().uordblks;
+}
+
+static int cycle() {
+    libusb_context *ctx;
+    libusb_device_handle *handle;
+
+    if (fake_usb_open(&ctx, &handle) < 0)
+        return -1;
+
+    struct libusb_webusb_init_timing timing;
+    libusb_webusb_get_init_timing(ctx, &timing);
+    worker_start_us += timing.worker_start_us;
+    init_us += timing.init_us;
+
+    fake_usb_configure(handle, LATENCY_US, 40000);
+
+    struct libusb_transfer *xfers[XFERS];
+    unsigned char *bufs[XFERS];
+    for (int i = 0; i < XFERS; i++) {
+        xfers[i] = libusb_alloc_transfer(0);
+        bufs[i] = libusb_dev_mem_alloc(handle, XFER_LEN);
+        libusb_fill_bulk_transfer(xfers[i], handle, FAKE_USB_EP_IN, bufs[i], XFER_LEN, callback, nullptr, 0);
+        libusb_submit_transfer(xfers[i]);
+    }
+
+    libusb_close(handle);
+    libusb_exit(ctx);
+
+    for (int i = 0; i < XFERS; i++) {
+        libusb_dev_mem_free(nullptr, bufs[i], XFER_LEN);
+        libusb_free_transfer(xfers[i]);
+    }
+
+    return 0;
+}
+
+int main() {
+    // Warm up the transfer pool and the device memory arena.
+    if (cycle() < 0)
+        return 1;
+
+    size_t heap = heap_in_use();
+    double start = emscripten_get_now();
+    worker_start_us = 0;
+    init_us = 0;
+
+    for (int i = 1; i <= CYCLES; i++) {
+        if (cycle() < 0)
+            return 1;
+
+        if (i % 10 == 0) {
+            std::cout << i << " cycles: " << (emscripten_get_now() - start) / i << " ms per cycle, heap "
+                      << (long)(heap_in_use() - heap) << " bytes above the first cycle" << std::endl;
+            std::cout << "  libusb_init: " << init_us / i << " us, of which worker start "
+                      << worker_start_us / i << " us" << std::endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <vector>
+
+#include <emscripten.h>
+
+#include "fake_usb.h"
+
+extern "C" {
+#include "libusb_webusb.h"
+}
+
+// Isochronous IN and OUT throughput against the scripted fake device, with
+// every completed transfer resubmitted from its callback. The fake device
+// misses some IN packets, which must show up as short packets while the
+// transfers themselves still complete.
+
+#define PACKETS         32
+#define XFERS           8
+#define RUN_MS          2000.0
+#define LATENCY_US      1000
+#define BANDWIDTH_KBPS  40000
+
+static bool running = false;
+static int outstanding = 0;
+static uint64_t bytes = 0;
+static uint64_t transfers = 0;
+static uint64_t failed = 0;
+static uint64_t short_packets = 0;
+
+static void LIBUSB_CALL callback(struct libusb_transfer *transfer) {
+    outstanding--;
+
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        failed++;
+        return;
+    }
+
+    transfers++;
+    for (int i = 0; i < transfer->num_iso_packets; i++) {
+        struct libusb_iso_packet_descriptor *desc = &transfer->iso_packet_desc[i];
+        if (desc->status != LIBUSB_TRANSFER_COMPLETED || desc->actual_length < desc->length)
+            short_packets++;
+        bytes += desc->actual_length;
+    }
+
+    if (running && libusb_submit_transfer(transfer) == 0)
+        outstanding++;
+}
+
+static void run(libusb_context *ctx, libusb_device_handle *handle, unsigned char endpoint) {
+    int length = PACKETS * FAKE_USB_ISO_PACKET;
+    std::vector<struct libusb_transfer*> xfers;
+
+    for (int i = 0; i < XFERS; i++) {
+        struct libusb_transfer *t = libusb_alloc_transfer(PACKETS);
+        unsigned char *buf = libusb_dev_mem_alloc(handle, length);
+        libusb_fill_iso_transfer(t, handle, endpoint, buf, length, PACKETS, callback, nullptr, 0);
+        libusb_set_iso_packet_lengths(t, FAKE_USB_ISO_PACKET);
+        xfers.push_back(t);
+    }
+
+    running = true;
+    bytes = 0;
+    transfers = 0;
+    failed = 0;
+    short_packets = 0;
+
+    double start = emscripten_get_now();
+    for (auto t : xfers) {
+        if (libusb_submit_transfer(t) == 0)
+            outstanding++;
+    }
+
+    while (emscripten_get_now() - start < RUN_MS)
+        libusb_handle_events(ctx);
+
+    double elapsed = emscripten_get_now() - start;
+
+    running = false;
+    while (outstanding > 0)
+        libusb_handle_events(ctx);
+
+    for (auto t : xfers) {
+        libusb_dev_mem_free(handle, t->buffer, length);
+        libusb_free_transfer(t);
+    }
+
+    std::cout << ((endpoint & LIBUSB_ENDPOINT_IN) ? "iso IN: " : "iso OUT: ")
+              << bytes / elapsed / 1000.0 << " MB/s, "
+              << transfers << " transfers completed, "
+              << failed << " failed, "
+              << short_packets << " short packets" << std::endl;
+}
+
+int main() {
+    libusb_context *ctx;
+    libusb_device_handle *handle;
+
+    if (fake_usb_open(&ctx, &handle) < 0)
+        return 1;
+
+    fake_usb_configure(handle, LATENCY_US, BANDWIDTH_KBPS);
+
+    std::cout << XFERS << " transfers of " << PACKETS << " x " << FAKE_USB_ISO_PACKET
+              << " byte packets" << std::endl;
+
+    run(ctx, handle, FAKE_USB_EP_ISO_IN);
+    run(ctx, handle, FAKE_USB_EP_ISO_OUT);
+
+    libusb_close(handle);
+    libusb_exit(ctx);
+
+    return 0;
+}
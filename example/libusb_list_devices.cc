@@ -34,6 +34,21 @@ int main() {
             std::cerr << "Error libusb_get_device_descriptor()." << std::endl;
             return 1;
         }
+
+        struct libusb_config_descriptor *config;
+        if (libusb_get_active_config_descriptor(list[i], &config) < 0)
+            continue;
+
+        for (int j = 0; j < config->bNumInterfaces; j++) {
+            const struct libusb_interface_descriptor *alt = &config->interface[j].altsetting[0];
+            for (int k = 0; k < alt->bNumEndpoints; k++) {
+                std::cout << "interface " << (int)alt->bInterfaceNumber
+                          << " endpoint 0x" << std::hex << (int)alt->endpoint[k].bEndpointAddress << std::dec
+                          << ", max packet " << alt->endpoint[k].wMaxPacketSize << std::endl;
+            }
+        }
+
+        libusb_free_config_descriptor(config);
     }
 
     libusb_free_device_list(list, 1);
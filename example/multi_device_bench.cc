@@ -0,0 +1,105 @@
+#include <iostream>
+#include <vector>
+
+#include <emscripten.h>
+
+#include "fake_usb.h"
+
+extern "C" {
+#include "libusb_webusb.h"
+}
+
+// Aggregate bulk IN throughput of one and of two fake devices streaming at
+// the same time, each on its own WebUSB worker. Every completion costs the
+// owning worker some thread time, as real WebUSB transfers do, so devices
+// that shared a worker would split its time between them.
+
+#define XFER_LEN        (64 * 1024)
+#define XFERS           16
+#define RUN_MS          3000.0
+#define LATENCY_US      1000
+#define BANDWIDTH_KBPS  40000
+#define CPU_US          1000
+
+static bool running = false;
+static uint64_t received = 0;
+static int outstanding = 0;
+
+static void LIBUSB_CALL callback(struct libusb_transfer *transfer) {
+    outstanding--;
+
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED)
+        return;
+
+    received += transfer->actual_length;
+
+    if (running && libusb_submit_transfer(transfer) == 0)
+        outstanding++;
+}
+
+static double run(libusb_context *ctx, std::vector<libusb_device_handle*> handles) {
+    std::vector<struct libusb_transfer*> xfers;
+
+    for (auto handle : handles) {
+        for (int i = 0; i < XFERS; i++) {
+            struct libusb_transfer *t = libusb_alloc_transfer(0);
+            unsigned char *buf = libusb_dev_mem_alloc(handle, XFER_LEN);
+            libusb_fill_bulk_transfer(t, handle, FAKE_USB_EP_IN, buf, XFER_LEN, callback, nullptr, 0);
+            xfers.push_back(t);
+        }
+    }
+
+    running = true;
+    received = 0;
+
+    double start = emscripten_get_now();
+    for (auto t : xfers) {
+        if (libusb_submit_transfer(t) == 0)
+            outstanding++;
+    }
+
+    while (emscripten_get_now() - start < RUN_MS)
+        libusb_handle_events(ctx);
+
+    double elapsed = emscripten_get_now() - start;
+    uint64_t bytes = received;
+
+    running = false;
+    while (outstanding > 0)
+        libusb_handle_events(ctx);
+
+    for (auto t : xfers) {
+        libusb_dev_mem_free(t->dev_handle, t->buffer, XFER_LEN);
+        libusb_free_transfer(t);
+    }
+
+    return bytes / elapsed / 1000.0;
+}
+
+int main() {
+    libusb_context *ctx;
+    libusb_device_handle *first, *second;
+
+    if (libusb_init(&ctx) < 0)
+        return 1;
+
+    libusb_webusb_set_worker_per_device(ctx, 1);
+
+    if (fake_usb_open_device(ctx, 0, &first) < 0 || fake_usb_open_device(ctx, 1, &second) < 0)
+        return 1;
+
+    fake_usb_configure(first, LATENCY_US, BANDWIDTH_KBPS, CPU_US);
+    fake_usb_configure(second, LATENCY_US, BANDWIDTH_KBPS, CPU_US);
+
+    std::cout << "bulk IN, " << XFER_LEN << " byte transfers, "
+              << CPU_US << " us of worker time per transfer" << std::endl;
+
+    std::cout << "one device: " << run(ctx, { first }) << " MB/s" << std::endl;
+    std::cout << "two devices: " << run(ctx, { first, second }) << " MB/s aggregate" << std::endl;
+
+    libusb_close(first);
+    libusb_close(second);
+    libusb_exit(ctx);
+
+    return 0;
+}
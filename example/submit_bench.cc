@@ -0,0 +1,83 @@
+#include <iostream>
+#include <vector>
+
+#include <emscripten.h>
+
+#include "fake_usb.h"
+
+extern "C" {
+#include "libusb_webusb.h"
+}
+
+// Cost of one libusb_submit_transfer call from the application thread,
+// through the worker's command ring and through Emscripten's proxy queue.
+// The fake device is made slow enough that no transfer finishes while the
+// calls are timed.
+
+#define XFER_LEN    512
+#define SUBMITS     1024
+#define ROUNDS      5
+#define LATENCY_US  60000000
+
+static int outstanding = 0;
+
+static void LIBUSB_CALL callback(struct libusb_transfer *transfer) {
+    outstanding--;
+}
+
+static double run(libusb_context *ctx, libusb_device_handle *handle) {
+    static unsigned char buf[XFER_LEN];
+    std::vector<struct libusb_transfer*> xfers;
+
+    for (int i = 0; i < SUBMITS; i++) {
+        struct libusb_transfer *t = libusb_alloc_transfer(0);
+        libusb_fill_bulk_transfer(t, handle, FAKE_USB_EP_IN, buf, XFER_LEN, callback, nullptr, 0);
+        xfers.push_back(t);
+    }
+
+    double start = emscripten_get_now();
+    for (auto t : xfers) {
+        if (libusb_submit_transfer(t) == 0)
+            outstanding++;
+    }
+    double elapsed = emscripten_get_now() - start;
+
+    struct timeval tv = { 0, 0 };
+
+    for (auto t : xfers)
+        libusb_cancel_transfer(t);
+    while (outstanding > 0)
+        libusb_handle_events_timeout_completed(ctx, &tv, nullptr);
+    for (auto t : xfers)
+        libusb_free_transfer(t);
+
+    return elapsed * 1000.0 / SUBMITS;
+}
+
+int main() {
+    libusb_context *ctx;
+    libusb_device_handle *handle;
+
+    if (fake_usb_open(&ctx, &handle) < 0)
+        return 1;
+
+    fake_usb_configure(handle, LATENCY_US, 40000);
+
+    for (int ring : { 1, 0 }) {
+        libusb_webusb_set_command_ring(ctx, ring);
+
+        double best = 0;
+        for (int i = 0; i < ROUNDS; i++) {
+            double us = run(ctx, handle);
+            if (!i || us < best)
+                best = us;
+        }
+
+        std::cout << (ring ? "command ring: " : "proxy queue: ") << best << " us per submit" << std::endl;
+    }
+
+    libusb_close(handle);
+    libusb_exit(ctx);
+
+    return 0;
+}
@@ -2,27 +2,234 @@
 #define INTERFACE_H
 
 #include "libusb.h"
+#include "libusb_webusb.h"
 
 #include <emscripten/threading.h>
 #include <emscripten/val.h>
 
+#include <vector>
+
+#include "ring.h"
+
+enum worker_command_op {
+    WORKER_COMMAND_SUBMIT,
+    WORKER_COMMAND_SUBMIT_MANY,
+    WORKER_COMMAND_CANCEL,
+    WORKER_COMMAND_FREE,
+    WORKER_COMMAND_CLOSE,
+    WORKER_COMMAND_RELEASE,
+};
+
+// A call sent through a worker's command ring. Only submits wait for their
+// result, which the worker stores in *result before it sets and futex-wakes
+// *done. SUBMIT_MANY takes count transfers from transfers instead of one.
+// CLOSE and RELEASE name their handle and interface instead of a transfer.
+typedef struct {
+    enum worker_command_op op;
+    struct libusb_transfer* transfer;
+    int* result;
+    _Atomic uint32_t* done;
+    struct libusb_transfer** transfers;
+    int count;
+    libusb_device_handle* dev_handle;
+    int interface_number;
+} worker_command;
+
+// The command ring of one worker and the doorbell it waits on. drained is
+// bumped and futex-woken whenever the worker emptied the ring, for callers
+// waiting on a full one.
+typedef struct {
+    mpsc_ring<worker_command, 1024> ring;
+    _Atomic uint32_t doorbell;
+    _Atomic uint32_t drained;
+} command_queue;
+
+// Which thread pops a context's completions, see webusb_context::consumer.
+enum completion_consumer {
+    CONSUMER_WORKER,
+    CONSUMER_CALLBACK_THREAD,
+};
+
+// A libusb context: its worker, the completions waiting for
+// libusb_handle_events() and its device list. Contexts share nothing, so
+// several libraries in one page can each init and exit their own.
 typedef struct {
     pthread_t worker;
+    command_queue* commands;
+    bool command_ring;      // see libusb_webusb_set_command_ring()
+    bool worker_per_device;
+
+    // Completed transfers waiting for their callback. The number of
+    // submitted transfers not yet handed back is capped at the ring size, so
+    // pushing a completion can never fail.
+    mpsc_ring<struct libusb_transfer*, 4096> completions;
+    _Atomic int outstanding;
+
+    // Completion bookkeeping, written by the workers. event_seq is bumped
+    // and futex-woken whenever a transfer completes or callbacks were
+    // delivered, so callers of handle_events can sleep on it instead of
+    // polling the worker.
+    _Atomic uint32_t completions_pushed;
+    _Atomic uint32_t completions_delivered;
+    _Atomic uint32_t event_seq;
+
+    // Completion callbacks on their own thread, see
+    // libusb_webusb_set_callback_thread(). consumer is the only thread that
+    // pops completions. It is switched on the worker, between its own
+    // deliveries, and never while the callback thread may be popping.
+    _Atomic bool has_callback_thread;
+    _Atomic int consumer;
+    _Atomic bool stop_callback_thread;
+    pthread_t callback_thread;
+
+    struct {
+        _Atomic uint64_t callbacks;
+        _Atomic uint64_t latency_us;
+        _Atomic uint32_t max_latency_us;
+        _Atomic uint64_t callback_us;
+        _Atomic uint64_t worker_callback_us;
+    } callback_stats;
+
+    libusb_device** dev_list;
+    ssize_t dev_list_len;
+
+    struct libusb_webusb_init_timing timing;
 } webusb_context;
 
+typedef struct {
+    libusb_webusb_batch_cb_fn callback;
+    void* user_data;
+} batch_callback;
+
+// Index of an endpoint address into per-endpoint arrays of 32 entries.
+static inline int endpoint_index(unsigned char endpoint) {
+    return (endpoint & 0x0f) | ((endpoint & LIBUSB_ENDPOINT_IN) >> 3);
+}
+
+// An open device. worker is the context's worker or the device's own, and id
+// its slot in that worker's handle table. Every libusb_open() makes one and
+// puts it on the device's list. refs counts the open itself plus every
+// completion of the handle not yet delivered, so the handle outlives
+// libusb_close() until its last completion was handed back, see
+// release_handle(). Handles still listed are freed by libusb_exit().
+typedef struct handle_context {
+    struct handle_context* next;
+    libusb_device* dev;
+    webusb_context* ctx;
+    pthread_t worker;
+    command_queue* commands;
+    int id;
+    _Atomic int refs;
+
+    // Largest packet size of the current configuration, the alignment of
+    // libusb_dev_mem_alloc() buffers. Written by the worker.
+    _Atomic int max_packet_size;
+
+    // Read wherever completions are delivered, see
+    // libusb_webusb_set_batch_callback(). The worker publishes a new entry
+    // for every change and keeps replaced ones in retired until the handle is
+    // freed, so a reader never sees a half-written or freed entry.
+    batch_callback* _Atomic batch[32];
+    std::vector<batch_callback*> retired;
+} handle_context;
+
+// The configuration descriptors of a device, in one block that starts with
+// this header. See _libusb_get_config_cache().
+typedef struct {
+    int num_configs;
+    struct libusb_config_descriptor* configs;
+} config_cache;
+
 typedef struct {
     libusb_device* idev;
     webusb_context* ctx;
+    bool has_worker;        // own worker, see libusb_webusb_set_worker_per_device()
+    pthread_t worker;
+    command_queue* commands;
+    handle_context* handles; // see handle_context
+    config_cache* configs;  // built on first use, freed by libusb_exit()
+
+    // bConfigurationValue of the active configuration or a libusb error, 0
+    // until read. Refreshed whenever a handle may have changed it.
+    _Atomic int active_config;
 } device_context;
 
+handle_context* hc(libusb_device_handle*);
+
+// Drop a reference to a handle, the last one frees it.
+void release_handle(handle_context*);
+
+// Worker only. True if calls on the handle first have to wait for device
+// operations that were dispatched without waiting.
+bool device_ops_queued(libusb_device_handle*);
+
+// Where a transfer's completion is, see transfer_context::delivery.
+enum transfer_delivery {
+    DELIVERY_NONE,          // not queued
+    DELIVERY_QUEUED,        // waiting in the context's completion ring
+    DELIVERY_RUNNING,       // popped, callback running
+    DELIVERY_FREED = 4,     // or-ed in when freed while queued or running
+};
+
+// Private per-transfer state, allocated in front of each libusb_transfer.
+// in_flight and delivery are read on the application's threads as well. A
+// transfer freed while its completion is queued or delivered is released by
+// the consumer, never by the free, so it cannot be reused before it left
+// the ring.
+typedef struct {
+    _Atomic bool in_flight;
+    uint32_t id;
+    int iso_capacity;
+    bool sync;          // submitted by libusb_bulk_transfer(), see read-ahead
+    bool out_view;      // OUT data passed as a view of wasm memory, see out_data()
+    _Atomic uint32_t delivery;
+    _Atomic bool cancel_requested; // stops auto-resubmit, cleared by libusb_submit_transfer()
+    double completed_at; // when the worker queued the completion
+} transfer_context;
+
+transfer_context* tc(struct libusb_transfer*);
+
+// libusb_submit_transfer() without clearing a pending cancel, for
+// auto-resubmit.
+int webusb_resubmit_transfer(struct libusb_transfer*);
+
+// A bulk IN stream. The worker fills the ring and advances head, the
+// consumer drains it from any thread and advances tail. Both indices run
+// freely and are masked with size - 1, which is a power of two.
+struct libusb_webusb_stream {
+    libusb_device_handle *dev_handle;
+    uint32_t id;
+    unsigned char endpoint;
+    unsigned char *ring;
+    uint32_t size;
+    int transfer_size;
+    int in_flight;
+    bool stopping;
+
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t dropped;
+    _Atomic uint32_t overruns;
+    _Atomic int error;
+};
+
+
 const struct libusb_version* _libusb_get_version(void);
 
 int _libusb_init(libusb_context**);
 
 ssize_t _libusb_get_device_list(libusb_context *, libusb_device ***);
 
+int _libusb_attach_devices(libusb_context *);
+
 int _libusb_get_device_descriptor(libusb_device *, struct libusb_device_descriptor *);
 
+int _libusb_get_config_cache(libusb_device *, config_cache **);
+
+int _libusb_get_active_config_value(libusb_device *);
+
 void _libusb_free_device_list(libusb_device **, int);
 
 int LIBUSB_CALL _libusb_open(libusb_device *, libusb_device_handle **);
@@ -40,12 +247,35 @@ int LIBUSB_CALL _libusb_release_interface(libusb_device_handle *, int);
 int LIBUSB_CALL _libusb_control_transfer(libusb_device_handle *, uint8_t, uint8_t, uint16_t, uint16_t,
         unsigned char *, uint16_t, unsigned int);
 
+int LIBUSB_CALL _libusb_webusb_control_batch(libusb_device_handle *, struct libusb_webusb_control_request *, int);
+
+int LIBUSB_CALL _libusb_webusb_set_split_size(libusb_device_handle *, unsigned char, int);
+
+int LIBUSB_CALL _libusb_webusb_set_read_ahead(libusb_device_handle *, unsigned char, int);
+
+int LIBUSB_CALL _libusb_webusb_set_autotune(libusb_device_handle *, unsigned char, int);
+
+int LIBUSB_CALL _libusb_webusb_get_tuning(libusb_device_handle *, unsigned char, struct libusb_webusb_tuning *);
+
+int LIBUSB_CALL _libusb_webusb_stream_start(libusb_device_handle *, unsigned char, unsigned char *, size_t,
+        int, int, struct libusb_webusb_stream **);
+
+int LIBUSB_CALL _libusb_webusb_stream_stop(struct libusb_webusb_stream *);
+
+int LIBUSB_CALL _libusb_interrupt_transfer(libusb_device_handle *, unsigned char, unsigned char *, int,
+        int *, unsigned int);
+
 struct libusb_transfer * LIBUSB_CALL _libusb_alloc_transfer(int);
 
 int LIBUSB_CALL _libusb_clear_halt(libusb_device_handle *, unsigned char);
 
 int LIBUSB_CALL _libusb_submit_transfer(struct libusb_transfer *);
 
+int LIBUSB_CALL _libusb_webusb_submit_transfers(struct libusb_transfer **, int);
+
+int LIBUSB_CALL _libusb_webusb_set_batch_callback(libusb_device_handle *, unsigned char,
+        libusb_webusb_batch_cb_fn, void *);
+
 void _libusb_exit(libusb_context *);
 
 int LIBUSB_CALL _libusb_reset_device(libusb_device_handle *);
@@ -56,10 +286,18 @@ int LIBUSB_CALL _libusb_cancel_transfer(struct libusb_transfer *);
 
 void LIBUSB_CALL _libusb_free_transfer(struct libusb_transfer *);
 
+unsigned char * LIBUSB_CALL _libusb_dev_mem_alloc(libusb_device_handle *, size_t);
+
+int LIBUSB_CALL _libusb_dev_mem_free(libusb_device_handle *, unsigned char *, size_t);
+
+void _libusb_webusb_get_pool_stats(struct libusb_webusb_pool_stats *);
+
 int LIBUSB_CALL _libusb_set_interface_alt_setting(libusb_device_handle*, int, int);
 
 int LIBUSB_CALL _libusb_handle_events_timeout(libusb_context *, struct timeval *);
 
 int LIBUSB_CALL _libusb_handle_events_timeout_completed(libusb_context *, struct timeval *, int *);
 
+int _libusb_webusb_set_consumer(libusb_context *, int);
+
 #endif
@@ -0,0 +1,278 @@
+/*
+ * WebUSB specific extensions to the libusb API.
+ *
+ * Everything declared here is implemented by this translation layer only and
+ * is not part of upstream libusb.
+ */
+
+#ifndef LIBUSB_WEBUSB_H
+#define LIBUSB_WEBUSB_H
+
+#include "libusb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Transfer pool counters, see libusb_webusb_get_pool_stats(). */
+struct libusb_webusb_pool_stats {
+    /** libusb_alloc_transfer() calls served from a free list */
+    uint32_t hits;
+
+    /** libusb_alloc_transfer() calls that had to allocate */
+    uint32_t misses;
+};
+
+/** Read the libusb_alloc_transfer() pool counters. */
+void LIBUSB_CALL libusb_webusb_get_pool_stats(struct libusb_webusb_pool_stats *stats);
+
+/** Extra flags for libusb_transfer::flags, next to \ref libusb_transfer_flags. */
+enum libusb_webusb_transfer_flags {
+    /** Submit the transfer again as soon as its callback returns, on the
+     * WebUSB worker, unless it failed, was cancelled or the callback
+     * submitted or freed it. Clear the flag or cancel the transfer to stop;
+     * a cancel also stops a transfer that completed but whose callback has
+     * not run yet. Submitting it again clears the cancel.
+     * If the resubmission fails, the transfer is handed back once more with
+     * an error status. */
+    LIBUSB_WEBUSB_TRANSFER_AUTO_RESUBMIT = (1U << 7)
+};
+
+/** Flags for libusb_webusb_control_request::flags. */
+enum libusb_webusb_control_flags {
+    /** Wait for every earlier request in the batch to complete before this
+     * one is issued. If any of them failed, this and all later requests are
+     * skipped and report LIBUSB_ERROR_INTERRUPTED. */
+    LIBUSB_WEBUSB_CONTROL_BARRIER = (1U << 0)
+};
+
+/** One request of a libusb_webusb_control_batch() call. The fields mirror
+ * the arguments of libusb_control_transfer(). */
+struct libusb_webusb_control_request {
+    uint8_t bmRequestType;
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+
+    /** Data stage buffer of wLength bytes */
+    unsigned char *data;
+
+    /** A bitwise OR combination of \ref libusb_webusb_control_flags. */
+    unsigned int flags;
+
+    /** Output: bytes transferred, or a LIBUSB_ERROR code */
+    int result;
+};
+
+/** Run a batch of control requests with a single crossing into the worker.
+ * Requests are issued to WebUSB back to back, in order, without waiting for
+ * each other unless LIBUSB_WEBUSB_CONTROL_BARRIER is set.
+ * \returns 0 if every request succeeded, otherwise the first failing
+ * request's error code. Per-request results are stored in
+ * libusb_webusb_control_request::result. */
+int LIBUSB_CALL libusb_webusb_control_batch(libusb_device_handle *dev_handle,
+    struct libusb_webusb_control_request *requests, int count);
+
+/** Split bulk IN transfers on endpoint that are longer than split_size bytes
+ * into several WebUSB transfers of at most split_size bytes, rounded down to
+ * the endpoint's packet size, which are issued concurrently. A part that
+ * comes back short ends the transfer, as a short packet does. The parts
+ * issued after it have already read the device's next transfers; their data
+ * is kept and handed to the next transfers submitted on the endpoint, in
+ * order, and while any is left every bulk IN transfer on the endpoint goes
+ * through it. 0 disables splitting. Off by default. */
+int LIBUSB_CALL libusb_webusb_set_split_size(libusb_device_handle *dev_handle,
+    unsigned char endpoint, int split_size);
+
+/** Serve libusb_bulk_transfer() reads on endpoint from a read-ahead buffer
+ * that is filled with WebUSB transfers of at least size bytes, so that runs
+ * of small reads share one round trip. Only use this on endpoints that are
+ * not also read with asynchronous transfers. 0 disables read-ahead and drops
+ * any buffered data. Off by default. */
+int LIBUSB_CALL libusb_webusb_set_read_ahead(libusb_device_handle *dev_handle,
+    unsigned char endpoint, int size);
+
+/** Operating point of a bulk IN endpoint, see libusb_webusb_get_tuning(). */
+struct libusb_webusb_tuning {
+    /** Size of the WebUSB transfers that reads are split into, 0 if they
+     * are not split */
+    int split_size;
+
+    /** WebUSB transfers kept in flight on the endpoint, 0 if unlimited */
+    int depth;
+
+    /** Throughput over the last measurement window, in bytes per second */
+    uint32_t throughput;
+
+    /** Mean WebUSB transfer latency over the last window, in microseconds */
+    uint32_t latency_us;
+
+    /** Nonzero once the auto-tuner has stopped probing */
+    int settled;
+};
+
+/** Let the library pick the split size and the number of WebUSB transfers
+ * in flight on a bulk IN endpoint from measured throughput. The application
+ * still decides the transfer length and how many transfers it submits; the
+ * tuner works within those. */
+int LIBUSB_CALL libusb_webusb_set_autotune(libusb_device_handle *dev_handle,
+    unsigned char endpoint, int enable);
+
+/** Read the current operating point and measurements of a bulk IN endpoint.
+ * Measurements cover split transfers only. */
+int LIBUSB_CALL libusb_webusb_get_tuning(libusb_device_handle *dev_handle,
+    unsigned char endpoint, struct libusb_webusb_tuning *tuning);
+
+/** A continuous bulk IN stream, see libusb_webusb_stream_start(). */
+struct libusb_webusb_stream;
+
+/** Stream counters, see libusb_webusb_stream_get_stats(). */
+struct libusb_webusb_stream_stats {
+    /** Bytes received from the device, including dropped ones */
+    uint64_t bytes;
+
+    /** Bytes dropped because the ring was full */
+    uint64_t dropped;
+
+    /** Number of transfers that did not fit into the ring in full */
+    uint32_t overruns;
+
+    /** 0 while streaming, otherwise the error that stopped the stream */
+    int error;
+};
+
+/** Start streaming from a bulk IN endpoint into ring, a caller-provided
+ * buffer whose size is a power of two. The library keeps the given number of
+ * WebUSB transfers of transfer_size bytes in flight and copies their data
+ * straight into the ring as they complete, with no libusb callbacks. Data that does
+ * not fit is dropped and counted. The ring must stay valid until
+ * libusb_webusb_stream_stop(). */
+int LIBUSB_CALL libusb_webusb_stream_start(libusb_device_handle *dev_handle,
+    unsigned char endpoint, unsigned char *ring, size_t ring_size,
+    int transfer_size, int transfers, struct libusb_webusb_stream **stream);
+
+/** Stop a stream and release it. Transfers still in flight are dropped when
+ * they complete. Any thread, but not concurrently with a read. */
+int LIBUSB_CALL libusb_webusb_stream_stop(struct libusb_webusb_stream *stream);
+
+/** Copy up to length bytes out of the stream's ring. Waits up to timeout
+ * milliseconds for data if the ring is empty, except on the main browser
+ * thread, which cannot block. A single consumer thread may read, without
+ * going through the WebUSB worker.
+ * \returns the number of bytes read */
+size_t LIBUSB_CALL libusb_webusb_stream_read(struct libusb_webusb_stream *stream,
+    unsigned char *data, size_t length, unsigned int timeout);
+
+/** Read the stream counters. Any thread. */
+void LIBUSB_CALL libusb_webusb_stream_get_stats(struct libusb_webusb_stream *stream,
+    struct libusb_webusb_stream_stats *stats);
+
+/** Call counts of one worker function, see libusb_webusb_get_call_stats(). */
+struct libusb_webusb_call_stats {
+    /** Name of the worker-side implementation, e.g. "_libusb_submit_transfer" */
+    const char *name;
+
+    /** Calls made on the WebUSB worker, e.g. from transfer callbacks, which
+     * ran the implementation directly */
+    uint32_t direct;
+
+    /** Calls proxied to the WebUSB worker from other threads */
+    uint32_t proxied;
+
+    /** Calls sent to the WebUSB worker through its command ring, see
+     * libusb_webusb_set_command_ring() */
+    uint32_t queued;
+};
+
+/** Read the call counters of every worker function called so far. At most
+ * count entries are written.
+ * \returns the number of functions with counters */
+int LIBUSB_CALL libusb_webusb_get_call_stats(struct libusb_webusb_call_stats *stats, int count);
+
+/** Send libusb_submit_transfer(), libusb_cancel_transfer(),
+ * libusb_free_transfer(), libusb_release_interface() and libusb_close() calls
+ * on ctx to the WebUSB worker through a dedicated command ring instead of
+ * Emscripten's generic proxy queue. Either way the calls of one thread reach
+ * the worker in the order they were made. On by default. */
+int LIBUSB_CALL libusb_webusb_set_command_ring(libusb_context *ctx, int enable);
+
+/** Run the completion callbacks of transfers on ctx on a thread of their
+ * own instead of the WebUSB worker, so slow callbacks do not hold up WebUSB
+ * promises. libusb_handle_events() then only waits for callbacks to be
+ * delivered. It can be switched at any time, transfers in flight are then
+ * delivered exactly once by whichever thread took over. It cannot be switched
+ * off from a callback running on the callback thread (LIBUSB_ERROR_BUSY). Off
+ * by default. */
+int LIBUSB_CALL libusb_webusb_set_callback_thread(libusb_context *ctx, int enable);
+
+/** Callback counters of a context, see libusb_webusb_get_callback_stats(). */
+struct libusb_webusb_callback_stats {
+    /** Number of completion callbacks run */
+    uint64_t callbacks;
+
+    /** Total time from completion on the worker until the callback started,
+     * in microseconds */
+    uint64_t latency_us;
+
+    /** Longest such time, in microseconds */
+    uint32_t max_latency_us;
+
+    /** Total time spent in callbacks, in microseconds */
+    uint64_t callback_us;
+
+    /** The part of callback_us spent on the WebUSB worker, where it holds
+     * up WebUSB promises */
+    uint64_t worker_callback_us;
+};
+
+/** Read the callback counters of ctx, or of the default context if ctx is
+ * NULL. */
+int LIBUSB_CALL libusb_webusb_get_callback_stats(libusb_context *ctx,
+    struct libusb_webusb_callback_stats *stats);
+
+/** Batch completion callback, see libusb_webusb_set_batch_callback().
+ * transfers holds count completed transfers of one endpoint in the order
+ * they were submitted, and is only valid during the call. */
+typedef void (LIBUSB_CALL *libusb_webusb_batch_cb_fn)(struct libusb_transfer **transfers,
+    int count, void *user_data);
+
+/** Deliver the completed transfers of an endpoint to callback, all that
+ * completed since the last delivery in one call, instead of calling each
+ * transfer's own callback. Pass NULL to go back to per-transfer callbacks.
+ * It can be changed at any time, completions are handed to whichever
+ * callback is set when they are delivered. */
+int LIBUSB_CALL libusb_webusb_set_batch_callback(libusb_device_handle *dev_handle,
+    unsigned char endpoint, libusb_webusb_batch_cb_fn callback, void *user_data);
+
+/** Submit several transfers of one device with a single call to the WebUSB
+ * worker, e.g. to resubmit a batch from its batch callback.
+ * \returns the number of transfers submitted, or the error of the first
+ * transfer if none was */
+int LIBUSB_CALL libusb_webusb_submit_transfers(struct libusb_transfer **transfers, int count);
+
+/** Startup cost of a context, see libusb_webusb_get_init_timing(). */
+struct libusb_webusb_init_timing {
+    /** Time from creating the WebUSB worker until it was running, in microseconds */
+    uint32_t worker_start_us;
+
+    /** Time libusb_init() took in total, in microseconds */
+    uint32_t init_us;
+};
+
+/** Read how long libusb_init() took to set up ctx, or the default context
+ * if ctx is NULL. */
+int LIBUSB_CALL libusb_webusb_get_init_timing(libusb_context *ctx,
+    struct libusb_webusb_init_timing *timing);
+
+/** Give every device opened on ctx from now on a WebUSB worker thread of
+ * its own, so that several devices stream in parallel instead of sharing
+ * one worker. Transfer callbacks still run in libusb_handle_events(). Off
+ * by default. */
+int LIBUSB_CALL libusb_webusb_set_worker_per_device(libusb_context *ctx, int enable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef RING_H
+#define RING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded lock-free multi-producer/single-consumer ring.
+//
+// Every slot carries a sequence number that tells producers whether it is
+// free and the consumer whether it holds a value, so producers only contend
+// on the head index and the consumer never blocks them. N must be a power of
+// two.
+template <typename T, size_t N>
+class mpsc_ring {
+    static_assert(N && !(N & (N - 1)), "ring size must be a power of two");
+
+    struct slot {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    slot slots[N];
+    std::atomic<size_t> head;
+    size_t tail;
+
+public:
+    mpsc_ring() : head(0), tail(0) {
+        for (size_t i = 0; i < N; i++)
+            slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // Returns false if the ring is full.
+    bool push(const T& value) {
+        size_t pos = head.load(std::memory_order_relaxed);
+
+        for (;;) {
+            slot& s = slots[pos & (N - 1)];
+            size_t seq = s.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot& s = slots[pos & (N - 1)];
+        s.value = value;
+        s.seq.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Consumer only. Returns false if the ring is empty.
+    bool pop(T& value) {
+        slot& s = slots[tail & (N - 1)];
+        size_t seq = s.seq.load(std::memory_order_acquire);
+
+        if ((intptr_t)seq - (intptr_t)(tail + 1) < 0)
+            return false;
+
+        value = s.value;
+        s.seq.store(tail + N, std::memory_order_release);
+        tail++;
+
+        return true;
+    }
+
+    static constexpr size_t capacity() {
+        return N;
+    }
+};
+
+#endif
@@ -1,8 +1,16 @@
 #include <iostream>
 
+#include <cmath>
+#include <climits>
+#include <mutex>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
 #include <pthread.h>
 #include <emscripten.h>
 #include <emscripten/threading.h>
+#include <emscripten/atomic.h>
 
 #include "libusb.h"
 #include "interface.h"
@@ -13,13 +21,35 @@
 // Helper functions.
 //
 
-static _Atomic bool started = false;
+// Handed to a new worker by start_worker(). The starter may return as soon
+// as it sees started, before the worker's wake is done with it, so both drop
+// a reference and the last one frees it.
+typedef struct {
+    _Atomic uint32_t started;
+    _Atomic int refs;
+    command_queue* commands;
+} worker_start;
+
+static void release_start(worker_start* start) {
+    if (--start->refs == 0)
+        delete start;
+}
+
+static thread_local command_queue* own_commands = nullptr;
 
-void *WUSBThread(void*) {
+static void arm_commands(command_queue* commands);
+
+void *WUSBThread(void* arg) {
 #ifdef DEBUG_TRACE
     std::cout << "WebUSB Thread Started (" << pthread_self() << ")" << std::endl;
 #endif
-    started = true;
+    worker_start* start = (worker_start*)arg;
+    own_commands = start->commands;
+    arm_commands(start->commands);
+
+    start->started = 1;
+    emscripten_futex_wake(&start->started, INT_MAX);
+    release_start(start);
     emscripten_exit_with_live_runtime();
     std::cout << "WebUSB Thread Done" << std::endl;
     return NULL;
@@ -37,74 +67,493 @@ webusb_context* wc(libusb_device* dev) {
     return dc(dev)->ctx;
 }
 
-webusb_context* wc(libusb_device_handle* dev_handle) {
-    return (webusb_context*)dev_handle;
+// Per-function counts of calls made on the worker itself, which run the
+// implementation directly, calls proxied to it and calls sent through its
+// command ring.
+typedef struct {
+    const char* name;
+    _Atomic uint32_t direct;
+    _Atomic uint32_t proxied;
+    _Atomic uint32_t queued;
+} call_stats;
+
+static std::mutex call_stats_lock;
+static std::vector<call_stats*> call_stats_list;
+
+static call_stats* register_call_stats(const char* name) {
+    call_stats* stats = new call_stats();
+    stats->name = name;
+
+    std::lock_guard<std::mutex> lock(call_stats_lock);
+    call_stats_list.push_back(stats);
+
+    return stats;
+}
+
+template<typename F, F fn>
+static call_stats& stats_for(const char* name) {
+    static call_stats* stats = register_call_stats(name);
+    return *stats;
+}
+
+#define CALL_STATS(fn) stats_for<decltype(&fn), &fn>(#fn)
+
+static void run_commands(command_queue* commands);
+
+// What a proxied call runs on the worker: the commands pushed before it,
+// then the function. See the command ring below.
+template<typename F, F fn>
+struct worker_entry;
+
+template<typename R, typename... P, R (*fn)(P...)>
+struct worker_entry<R (*)(P...), fn> {
+    static R call(P... args) {
+        if (own_commands)
+            run_commands(own_commands);
+        return fn(args...);
+    }
+};
+
+#define WORKER_ENTRY(fn) &worker_entry<decltype(&fn), &fn>::call
+
+// Run a worker function on the worker. Transfer callbacks already run there,
+// and proxying to the current thread would only queue behind it, so those
+// calls go straight to the implementation.
+template<typename R, typename... P, typename... A>
+static R worker_call(pthread_t worker, EM_FUNC_SIGNATURE sig, R (*fn)(P...), R (*entry)(P...),
+        call_stats& stats, A... args) {
+    if (pthread_equal(pthread_self(), worker)) {
+        stats.direct++;
+        return fn(args...);
+    }
+
+    stats.proxied++;
+    return (R)emscripten_dispatch_to_thread_sync(worker, sig, entry, nullptr, args...);
+}
+
+#define WORKER_CALL(worker, sig, fn, ...) \
+    worker_call(worker, sig, fn, WORKER_ENTRY(fn), CALL_STATS(fn), ##__VA_ARGS__)
+
+// Queue a worker function without waiting for it. Calls to the worker run in
+// the order they were queued, so a later WORKER_CALL from the same thread
+// still observes its effects.
+template<typename R, typename... P, typename... A>
+static void worker_post(pthread_t worker, EM_FUNC_SIGNATURE sig, R (*fn)(P...), R (*entry)(P...),
+        call_stats& stats, A... args) {
+    if (pthread_equal(pthread_self(), worker)) {
+        stats.direct++;
+        fn(args...);
+        return;
+    }
+
+    stats.proxied++;
+    emscripten_dispatch_to_thread_async(worker, sig, entry, nullptr, args...);
+}
+
+#define WORKER_POST(worker, sig, fn, ...) \
+    worker_post(worker, sig, fn, WORKER_ENTRY(fn), CALL_STATS(fn), ##__VA_ARGS__)
+
+//
+// Command ring.
+//
+// Submit, cancel and free are the calls made thousands of times a second.
+// Instead of the generic proxy queue, which allocates and marshals a message
+// per call, they go through a fixed ring per worker. The caller pushes the
+// command and rings the doorbell; the worker waits on the doorbell with
+// Atomics.waitAsync, so it drains the ring between event loop turns without
+// blocking its promises.
+//
+// Commands run in the order they were pushed. Against proxied calls, which
+// keep the generic queue, a thread's calls stay in order as well:
+//  - every proxied call first runs the commands already in the ring, so it
+//    never overtakes a command pushed before it;
+//  - calls that do not wait, close and release included, go through the
+//    ring, so a later command cannot overtake them either; a full ring is
+//    waited on rather than bypassed;
+//  - turning the ring back on waits for the proxied calls already queued.
+//
+
+static thread_local ATOMICS_WAIT_TOKEN_T command_wait;
+
+static void finish_submit(struct libusb_transfer* transfer, int* result, _Atomic uint32_t* done) {
+    *result = _libusb_submit_transfer(transfer);
+    *done = 1;
+    emscripten_futex_wake(done, 1);
+}
+
+static void finish_submit_many(struct libusb_transfer** transfers, int count, int* result, _Atomic uint32_t* done) {
+    *result = _libusb_webusb_submit_transfers(transfers, count);
+    *done = 1;
+    emscripten_futex_wake(done, 1);
+}
+
+static bool any_device_ops_queued(struct libusb_transfer** transfers, int count) {
+    for (int i = 0; i < count; i++) {
+        if (device_ops_queued(transfers[i]->dev_handle))
+            return true;
+    }
+    return false;
+}
+
+static void run_command(const worker_command& cmd) {
+    switch (cmd.op) {
+        case WORKER_COMMAND_SUBMIT:
+            // Waiting for queued device operations needs a worker entry
+            // point, which a waitAsync handler is not, so hand those submits
+            // to the proxy queue of this worker.
+            if (device_ops_queued(cmd.transfer->dev_handle)) {
+                emscripten_dispatch_to_thread_async(pthread_self(), EM_FUNC_SIG_VIII, finish_submit, nullptr,
+                        cmd.transfer, cmd.result, cmd.done);
+            } else {
+                finish_submit(cmd.transfer, cmd.result, cmd.done);
+            }
+            break;
+        case WORKER_COMMAND_SUBMIT_MANY:
+            if (any_device_ops_queued(cmd.transfers, cmd.count)) {
+                emscripten_dispatch_to_thread_async(pthread_self(), EM_FUNC_SIG_VIIII, finish_submit_many, nullptr,
+                        cmd.transfers, cmd.count, cmd.result, cmd.done);
+            } else {
+                finish_submit_many(cmd.transfers, cmd.count, cmd.result, cmd.done);
+            }
+            break;
+        case WORKER_COMMAND_CANCEL:
+            _libusb_cancel_transfer(cmd.transfer);
+            break;
+        case WORKER_COMMAND_FREE:
+            _libusb_free_transfer(cmd.transfer);
+            break;
+        case WORKER_COMMAND_CLOSE:
+            _libusb_close(cmd.dev_handle);
+            break;
+        case WORKER_COMMAND_RELEASE:
+            _libusb_release_interface(cmd.dev_handle, cmd.interface_number);
+            break;
+    }
+}
+
+// Worker only.
+static void run_commands(command_queue* commands) {
+    worker_command cmd;
+    bool ran = false;
+
+    while (commands->ring.pop(cmd)) {
+        run_command(cmd);
+        ran = true;
+    }
+
+    if (ran) {
+        commands->drained++;
+        emscripten_futex_wake(&commands->drained, INT_MAX);
+    }
+}
+
+static void commands_rung(int32_t* addr, uint32_t value, ATOMICS_WAIT_RESULT_T result, void* arg) {
+    arm_commands((command_queue*)arg);
+}
+
+// Worker only. Run what is queued, then wait for the doorbell again. A
+// doorbell rung in between makes the wait fail, so drain once more.
+static void arm_commands(command_queue* commands) {
+    for (;;) {
+        uint32_t doorbell = commands->doorbell;
+
+        run_commands(commands);
+
+        command_wait = emscripten_atomic_wait_async((void*)&commands->doorbell, doorbell,
+                commands_rung, commands, INFINITY);
+        if (EMSCRIPTEN_IS_VALID_WAIT_TOKEN(command_wait))
+            return;
+    }
+}
+
+static void ring_doorbell(command_queue* commands) {
+    commands->doorbell++;
+    emscripten_futex_wake(&commands->doorbell, 1);
+}
+
+// Push a command to the handle's worker, waiting for room if the ring is
+// full. Returns false if the command ring is off or the caller is the worker
+// itself; the caller then makes the call the usual way.
+static bool push_command(handle_context* h, const worker_command& cmd, call_stats& stats) {
+    if (!h->ctx->command_ring || pthread_equal(pthread_self(), h->worker))
+        return false;
+
+    // A close may free h as soon as it is pushed.
+    command_queue* commands = h->commands;
+
+    for (;;) {
+        uint32_t drained = commands->drained;
+
+        if (commands->ring.push(cmd))
+            break;
+
+        ring_doorbell(commands);
+        emscripten_futex_wait(&commands->drained, drained, INFINITY);
+    }
+
+    stats.queued++;
+    ring_doorbell(commands);
+
+    return true;
+}
+
+// Start a worker and wait until it runs. Other threads sleep on the started
+// flag until the worker wakes them. The main browser thread has to return to
+// its event loop for the browser to start the worker, so it yields instead.
+static int start_worker(pthread_t* worker, command_queue* commands) {
+    worker_start* start = new worker_start();
+    start->started = 0;
+    start->refs = 2;
+    start->commands = commands;
+
+    if (pthread_create(worker, NULL, WUSBThread, (void*)start) != 0) {
+        delete start;
+        return LIBUSB_ERROR_NOT_SUPPORTED;
+    }
+
+    while (!start->started) {
+        if (emscripten_is_main_browser_thread())
+            emscripten_sleep(1);
+        else
+            emscripten_futex_wait(&start->started, 0, INFINITY);
+    }
+    release_start(start);
+
+    std::cout << "webusb thread: " << *worker << std::endl;
+
+    return LIBUSB_SUCCESS;
+}
+
+static void exit_worker() {
+    emscripten_atomic_cancel_wait_async(command_wait);
+    pthread_exit(NULL);
+}
+
+// Tear down the worker's state for ctx, then end the thread. The exit is
+// queued behind the teardown, so joining returns once both ran.
+static void stop_worker(pthread_t worker, webusb_context* ctx) {
+    WORKER_CALL(worker, EM_FUNC_SIG_VI, _libusb_exit, (libusb_context*)ctx);
+    WORKER_POST(worker, EM_FUNC_SIG_V, exit_worker);
+    pthread_join(worker, NULL);
+}
+
+// Deliver completions of ctx whenever the worker queued some. This is the
+// worker's handle_events implementation, run on this thread instead.
+static void *callback_thread(void* arg) {
+    webusb_context* ctx = (webusb_context*)arg;
+
+    while (!ctx->stop_callback_thread) {
+        uint32_t seq = ctx->event_seq;
+
+        // Completions stay with the worker until it hands them over.
+        if (ctx->consumer == CONSUMER_CALLBACK_THREAD &&
+            ctx->completions_pushed != ctx->completions_delivered) {
+            _libusb_handle_events_timeout_completed((libusb_context*)ctx, nullptr, nullptr);
+            continue;
+        }
+
+        emscripten_futex_wait(&ctx->event_seq, seq, INFINITY);
+    }
+
+    return NULL;
+}
+
+// The thread stops popping once joined, only then the worker takes the
+// completions back.
+static void stop_callback_thread(webusb_context* ctx) {
+    if (!ctx->has_callback_thread)
+        return;
+
+    ctx->stop_callback_thread = true;
+    ctx->event_seq++;
+    emscripten_futex_wake(&ctx->event_seq, INT_MAX);
+    pthread_join(ctx->callback_thread, NULL);
+
+    WORKER_CALL(ctx->worker, EM_FUNC_SIG_III, _libusb_webusb_set_consumer,
+            (libusb_context*)ctx, (int)CONSUMER_WORKER);
+
+    ctx->has_callback_thread = false;
+    ctx->stop_callback_thread = false;
 }
 
 //
 // Proxied methods.
 //
 
-static webusb_context* _ctx = NULL;
+// The context used when NULL is passed. It lives from the first
+// libusb_init(NULL) to the matching libusb_exit(NULL).
+static webusb_context* default_ctx = NULL;
+static int default_refs = 0;
+
+static webusb_context* ctx_of(libusb_context* ctx) {
+    return ctx ? wc(ctx) : default_ctx;
+}
 
 int libusb_init(libusb_context** ctx) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
 
-    if(!_ctx) {
-        std::cout << "creating webusb_context" << std::endl;
-        _ctx = (webusb_context*)calloc(1, sizeof(webusb_context));
+    if (!ctx && default_ctx) {
+        default_refs++;
+        return LIBUSB_SUCCESS;
+    }
 
-        if (pthread_create(&_ctx->worker, NULL, WUSBThread, nullptr) != 0)
-            return LIBUSB_ERROR_NOT_SUPPORTED;
+    std::cout << "creating webusb_context" << std::endl;
+    webusb_context* c = new webusb_context();
+    c->commands = new command_queue();
+    c->command_ring = true;
+    double start = emscripten_get_now();
 
-        while (!started)
-            emscripten_sleep(100);
+    if (start_worker(&c->worker, c->commands) != LIBUSB_SUCCESS) {
+        delete c->commands;
+        delete c;
+        return LIBUSB_ERROR_NOT_SUPPORTED;
+    }
 
-        std::cout << "webusb thread: " << _ctx->worker << std::endl;
-        *ctx = (libusb_context*)_ctx;
+    double started = emscripten_get_now();
 
-        return emscripten_dispatch_to_thread_sync(_ctx->worker, EM_FUNC_SIG_II, _libusb_init, nullptr);
+    int r = WORKER_CALL(c->worker, EM_FUNC_SIG_II, _libusb_init, nullptr);
+    if (r != LIBUSB_SUCCESS) {
+        stop_worker(c->worker, c);
+        delete c->commands;
+        delete c;
+        return r;
+    }
 
+    c->timing.worker_start_us = (started - start) * 1000.0;
+    c->timing.init_us = (emscripten_get_now() - start) * 1000.0;
+
+    if (ctx) {
+        *ctx = (libusb_context*)c;
     } else {
-        std::cout << "use existing webusb_context" << std::endl;
-        std::cout << "webusb thread: " << _ctx->worker << std::endl;
+        default_ctx = c;
+        default_refs = 1;
     }
 
-    *ctx = (libusb_context *)_ctx;
-    return 0;
+    return LIBUSB_SUCCESS;
+}
+
+// Guards the devices' handle lists.
+static std::mutex handles_lock;
+
+static void free_handle(handle_context* h) {
+    for (int e = 0; e < 32; e++)
+        delete h->batch[e];
+    for (auto batch : h->retired)
+        delete batch;
+    delete h;
+}
+
+void release_handle(handle_context* h) {
+    if (--h->refs)
+        return;
+
+    device_context* d = dc(h->dev);
+    {
+        std::lock_guard<std::mutex> lock(handles_lock);
+        handle_context** link = &d->handles;
+        while (*link != h)
+            link = &(*link)->next;
+        *link = h->next;
+    }
+
+    free_handle(h);
+}
+
+// True on the threads libusb_exit() joins, e.g. in a completion callback.
+static bool on_context_thread(webusb_context* c) {
+    pthread_t self = pthread_self();
+
+    if (pthread_equal(self, c->worker))
+        return true;
+    if (c->has_callback_thread && pthread_equal(self, c->callback_thread))
+        return true;
+
+    for (ssize_t i = 0; i < c->dev_list_len; i++) {
+        device_context* d = dc(c->dev_list[i]);
+        if (d->has_worker && pthread_equal(self, d->worker))
+            return true;
+    }
+
+    return false;
 }
 
 void libusb_exit(libusb_context *ctx) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-}
+    webusb_context* c = ctx_of(ctx);
+    if (!c)
+        return;
+
+    if (on_context_thread(c)) {
+        std::cout << "libusb_exit: not allowed from a worker or callback thread" << std::endl;
+        return;
+    }
+
+    if (!ctx) {
+        if (--default_refs)
+            return;
+        default_ctx = NULL;
+    }
+
+    // The callback thread may be waiting on the workers, so it goes first.
+    stop_callback_thread(c);
+
+    // Device workers first, since they deliver into the context's queue.
+    for (ssize_t i = 0; i < c->dev_list_len; i++) {
+        device_context* d = dc(c->dev_list[i]);
+        if (d->has_worker)
+            stop_worker(d->worker, c);
+    }
 
-static ssize_t _dev_list_len = 0;
-static libusb_device** _dev_list = NULL;
+    stop_worker(c->worker, c);
+
+    for (ssize_t i = 0; i < c->dev_list_len; i++) {
+        device_context* d = dc(c->dev_list[i]);
+        free(d->idev);
+        free(d->configs);
+        while (d->handles) {
+            handle_context* h = d->handles;
+            d->handles = h->next;
+            free_handle(h);
+        }
+        delete d->commands;
+        free(d);
+    }
+    free(c->dev_list);
+
+    delete c->commands;
+    delete c;
+}
 
 ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
+    webusb_context* c = ctx_of(ctx);
+    if (!c)
+        return LIBUSB_ERROR_INVALID_PARAM;
 
-    if(_dev_list) {
-        *list = _dev_list;
-        return _dev_list_len;
+    if(c->dev_list) {
+        *list = c->dev_list;
+        return c->dev_list_len;
     }
 
     libusb_device** _list;
 
-    size_t n = emscripten_dispatch_to_thread_sync(wc(ctx)->worker, EM_FUNC_SIG_III, _libusb_get_device_list, nullptr,
-            1, &_list);
+    ssize_t n = WORKER_CALL(c->worker, EM_FUNC_SIG_III, _libusb_get_device_list,
+            nullptr, &_list);
+
+    if (n < 0)
+        return n;
 
     libusb_device** l = (libusb_device**)malloc(sizeof(libusb_device*) * (n + 2));
 
     for (int i = 0; i < n; i++) {
-        auto dc = (device_context*)malloc(sizeof(device_context));
-        dc->ctx = wc(ctx);
+        auto dc = (device_context*)calloc(1, sizeof(device_context));
+        dc->ctx = c;
         dc->idev = _list[i];
         l[i] = (libusb_device*)dc;
     }
@@ -112,10 +561,10 @@ ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list) {
     free(_list);
 
     l[n] = nullptr;
-    l[n+1] = (libusb_device*)ctx;
+    l[n+1] = (libusb_device*)c;
 
-    _dev_list = l;
-    _dev_list_len = n;
+    c->dev_list = l;
+    c->dev_list_len = n;
 
     *list = l;
 
@@ -148,7 +597,7 @@ void libusb_free_device_list(libusb_device **list, int unref_devices) {
 
     free(list);
 
-    emscripten_dispatch_to_thread_sync(thread, EM_FUNC_SIG_VII, _libusb_free_device_list, nullptr,
+    WORKER_CALL(thread, EM_FUNC_SIG_VII, _libusb_free_device_list,
             _list, unref_devices);
 }
 
@@ -156,26 +605,259 @@ int libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descri
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    std::cout << "webusb thread: " << _ctx->worker << std::endl;
-    return emscripten_dispatch_to_thread_sync(wc(dev)->worker, EM_FUNC_SIG_III, _libusb_get_device_descriptor, nullptr,
+    return WORKER_CALL(wc(dev)->worker, EM_FUNC_SIG_III, _libusb_get_device_descriptor,
             dc(dev)->idev, desc);
 }
 
+// Guards building a device's descriptor cache, which any thread may ask for.
+static std::mutex config_lock;
+
+static config_cache* configs_of(libusb_device *dev) {
+    device_context* d = dc(dev);
+
+    std::lock_guard<std::mutex> lock(config_lock);
+    if (!d->configs)
+        WORKER_CALL(wc(dev)->worker, EM_FUNC_SIG_III, _libusb_get_config_cache, d->idev, &d->configs);
+
+    return d->configs;
+}
+
+// The descriptors are owned by the device's cache and stay valid until
+// libusb_exit(), so getting one does not allocate or cross to the worker
+// once the cache is built.
+int LIBUSB_CALL libusb_get_config_descriptor(libusb_device *dev,
+        uint8_t config_index, struct libusb_config_descriptor **config) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    config_cache* cache = configs_of(dev);
+    if (!cache)
+        return LIBUSB_ERROR_NO_DEVICE;
+    if (config_index >= cache->num_configs)
+        return LIBUSB_ERROR_NOT_FOUND;
+
+    *config = &cache->configs[config_index];
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_get_config_descriptor_by_value(libusb_device *dev,
+        uint8_t bConfigurationValue, struct libusb_config_descriptor **config) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    config_cache* cache = configs_of(dev);
+    if (!cache)
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    for (int i = 0; i < cache->num_configs; i++) {
+        if (cache->configs[i].bConfigurationValue == bConfigurationValue) {
+            *config = &cache->configs[i];
+            return LIBUSB_SUCCESS;
+        }
+    }
+
+    return LIBUSB_ERROR_NOT_FOUND;
+}
+
+// Read the active configuration on worker, which holds the USBDevice whose
+// configuration may just have changed.
+static void update_active_config(libusb_device *dev, pthread_t worker) {
+    dc(dev)->active_config = WORKER_CALL(worker, EM_FUNC_SIG_II, _libusb_get_active_config_value, dc(dev)->idev);
+}
+
+int LIBUSB_CALL libusb_get_active_config_descriptor(libusb_device *dev,
+        struct libusb_config_descriptor **config) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    if (!dc(dev)->active_config)
+        update_active_config(dev, wc(dev)->worker);
+
+    int value = dc(dev)->active_config;
+    if (value < 0)
+        return value;
+
+    return libusb_get_config_descriptor_by_value(dev, value, config);
+}
+
+void LIBUSB_CALL libusb_free_config_descriptor(struct libusb_config_descriptor *config) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+}
+
 int LIBUSB_CALL libusb_open(libusb_device *dev, libusb_device_handle **dev_handle) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    *dev_handle = (libusb_device_handle*)wc(dev);
-    return emscripten_dispatch_to_thread_sync(wc(dev)->worker, EM_FUNC_SIG_III, _libusb_open, nullptr,
-            dc(dev)->idev, nullptr);
+    device_context* d = dc(dev);
+    pthread_t worker = d->ctx->worker;
+    command_queue* commands = d->ctx->commands;
+
+    // A device with a worker of its own is opened there, and the handle
+    // routes every later call to it.
+    if (d->ctx->worker_per_device) {
+        if (!d->has_worker) {
+            d->commands = new command_queue();
+            if (start_worker(&d->worker, d->commands) != LIBUSB_SUCCESS) {
+                delete d->commands;
+                d->commands = NULL;
+                return LIBUSB_ERROR_NOT_SUPPORTED;
+            }
+            d->has_worker = true;
+        }
+
+        worker = d->worker;
+        commands = d->commands;
+        int r = WORKER_CALL(worker, EM_FUNC_SIG_II, _libusb_attach_devices, (libusb_context*)d->ctx);
+        if (r < 0)
+            return r;
+    }
+
+    handle_context* h = new handle_context();
+    h->ctx = d->ctx;
+    h->worker = worker;
+    h->commands = commands;
+    h->dev = dev;
+    h->refs = 1;
+
+    libusb_device_handle* handle = (libusb_device_handle*)h;
+    int r = WORKER_CALL(worker, EM_FUNC_SIG_III, _libusb_open,
+            d->idev, &handle);
+
+    if (r != LIBUSB_SUCCESS) {
+        delete h;
+        return r;
+    }
+
+    update_active_config(dev, worker);
+
+    {
+        std::lock_guard<std::mutex> lock(handles_lock);
+        h->next = d->handles;
+        d->handles = h;
+    }
+
+    *dev_handle = handle;
+    return r;
+}
+
+int LIBUSB_CALL libusb_webusb_get_init_timing(libusb_context *ctx,
+    struct libusb_webusb_init_timing *timing) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    webusb_context* c = ctx_of(ctx);
+    if (!c)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    *timing = c->timing;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_webusb_set_callback_thread(libusb_context *ctx, int enable) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    webusb_context* c = ctx_of(ctx);
+    if (!c)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    if (!enable) {
+        // The thread cannot join itself.
+        if (c->has_callback_thread && pthread_equal(pthread_self(), c->callback_thread))
+            return LIBUSB_ERROR_BUSY;
+
+        stop_callback_thread(c);
+        return LIBUSB_SUCCESS;
+    }
+
+    if (c->has_callback_thread)
+        return LIBUSB_SUCCESS;
+
+    if (pthread_create(&c->callback_thread, NULL, callback_thread, c) != 0)
+        return LIBUSB_ERROR_NOT_SUPPORTED;
+
+    c->has_callback_thread = true;
+
+    // Taken over between two deliveries of the worker, so transfers already
+    // in flight keep exactly one consumer.
+    WORKER_CALL(c->worker, EM_FUNC_SIG_III, _libusb_webusb_set_consumer,
+            (libusb_context*)c, (int)CONSUMER_CALLBACK_THREAD);
+
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_webusb_get_callback_stats(libusb_context *ctx,
+    struct libusb_webusb_callback_stats *stats) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    webusb_context* c = ctx_of(ctx);
+    if (!c)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    stats->callbacks = c->callback_stats.callbacks;
+    stats->latency_us = c->callback_stats.latency_us;
+    stats->max_latency_us = c->callback_stats.max_latency_us;
+    stats->callback_us = c->callback_stats.callback_us;
+    stats->worker_callback_us = c->callback_stats.worker_callback_us;
+
+    return LIBUSB_SUCCESS;
+}
+
+static void flush_worker() {
+}
+
+// Wait until the workers of ctx ran every call queued so far.
+static void flush_workers(webusb_context* ctx) {
+    for (ssize_t i = 0; i < ctx->dev_list_len; i++) {
+        device_context* d = dc(ctx->dev_list[i]);
+        if (d->has_worker)
+            WORKER_CALL(d->worker, EM_FUNC_SIG_V, flush_worker);
+    }
+
+    WORKER_CALL(ctx->worker, EM_FUNC_SIG_V, flush_worker);
+}
+
+int LIBUSB_CALL libusb_webusb_set_command_ring(libusb_context *ctx, int enable) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    webusb_context* c = ctx_of(ctx);
+    if (!c)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    // Commands pushed from now on must not overtake calls still queued.
+    if (enable && !c->command_ring)
+        flush_workers(c);
+
+    c->command_ring = enable;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_webusb_set_worker_per_device(libusb_context *ctx, int enable) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    webusb_context* c = ctx_of(ctx);
+    if (!c)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    c->worker_per_device = enable;
+    return LIBUSB_SUCCESS;
 }
 
 void LIBUSB_CALL libusb_close(libusb_device_handle *dev_handle) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    emscripten_dispatch_to_thread_sync(wc(dev_handle)->worker, EM_FUNC_SIG_VI, _libusb_close, nullptr,
-            nullptr);
+    worker_command cmd{WORKER_COMMAND_CLOSE};
+    cmd.dev_handle = dev_handle;
+
+    if (!push_command(hc(dev_handle), cmd, CALL_STATS(_libusb_close)))
+        WORKER_POST(hc(dev_handle)->worker, EM_FUNC_SIG_VI, _libusb_close,
+                dev_handle);
 }
 
 int LIBUSB_CALL libusb_get_string_descriptor_ascii(libusb_device_handle *dev_handle,
@@ -183,32 +865,42 @@ int LIBUSB_CALL libusb_get_string_descriptor_ascii(libusb_device_handle *dev_han
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    return emscripten_dispatch_to_thread_sync(wc(dev_handle)->worker, EM_FUNC_SIG_IIIII, _libusb_get_string_descriptor_ascii, nullptr,
-            nullptr, desc_index, data, length);
+    return WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_IIIII, _libusb_get_string_descriptor_ascii,
+            dev_handle, desc_index, data, length);
 }
 
 int LIBUSB_CALL libusb_set_configuration(libusb_device_handle *dev_handle, int configuration) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    return emscripten_dispatch_to_thread_sync(wc(dev_handle)->worker, EM_FUNC_SIG_III, _libusb_set_configuration, nullptr,
-            nullptr, configuration);
+    int r = WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_III, _libusb_set_configuration,
+            dev_handle, configuration);
+
+    update_active_config(hc(dev_handle)->dev, hc(dev_handle)->worker);
+    return r;
 }
 
 int LIBUSB_CALL libusb_claim_interface(libusb_device_handle *dev_handle, int interface_number) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    return emscripten_dispatch_to_thread_sync(wc(dev_handle)->worker, EM_FUNC_SIG_III, _libusb_claim_interface, nullptr,
-            nullptr, interface_number);
+    return WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_III, _libusb_claim_interface,
+            dev_handle, interface_number);
 }
 
 int LIBUSB_CALL libusb_release_interface(libusb_device_handle *dev_handle, int interface_number) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    return emscripten_dispatch_to_thread_sync(wc(dev_handle)->worker, EM_FUNC_SIG_III, _libusb_release_interface, nullptr,
-            nullptr, interface_number);
+    worker_command cmd{WORKER_COMMAND_RELEASE};
+    cmd.dev_handle = dev_handle;
+    cmd.interface_number = interface_number;
+
+    if (!push_command(hc(dev_handle), cmd, CALL_STATS(_libusb_release_interface)))
+        WORKER_POST(hc(dev_handle)->worker, EM_FUNC_SIG_III, _libusb_release_interface,
+                dev_handle, interface_number);
+
+    return LIBUSB_SUCCESS;
 }
 
 int LIBUSB_CALL libusb_control_transfer(libusb_device_handle *dev_handle,
@@ -217,64 +909,287 @@ int LIBUSB_CALL libusb_control_transfer(libusb_device_handle *dev_handle,
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    return emscripten_dispatch_to_thread_sync(wc(dev_handle)->worker, EM_FUNC_SIG_IIIIIIIII, _libusb_control_transfer, nullptr,
-            nullptr, request_type, bRequest, wValue, wIndex, data, wLength, timeout);
+    return WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_IIIIIIIII, _libusb_control_transfer,
+            dev_handle, request_type, bRequest, wValue, wIndex, data, wLength, timeout);
+}
+
+int LIBUSB_CALL libusb_webusb_control_batch(libusb_device_handle *dev_handle,
+    struct libusb_webusb_control_request *requests, int count) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    return WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_IIII, _libusb_webusb_control_batch,
+            dev_handle, requests, count);
+}
+
+int LIBUSB_CALL libusb_webusb_set_split_size(libusb_device_handle *dev_handle,
+    unsigned char endpoint, int split_size) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    return WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_IIII, _libusb_webusb_set_split_size,
+            dev_handle, endpoint, split_size);
+}
+
+int LIBUSB_CALL libusb_webusb_set_read_ahead(libusb_device_handle *dev_handle,
+    unsigned char endpoint, int size) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    return WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_IIII, _libusb_webusb_set_read_ahead,
+            dev_handle, endpoint, size);
+}
+
+int LIBUSB_CALL libusb_webusb_set_autotune(libusb_device_handle *dev_handle,
+    unsigned char endpoint, int enable) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    return WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_IIII, _libusb_webusb_set_autotune,
+            dev_handle, endpoint, enable);
+}
+
+int LIBUSB_CALL libusb_webusb_get_tuning(libusb_device_handle *dev_handle,
+    unsigned char endpoint, struct libusb_webusb_tuning *tuning) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    return WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_IIII, _libusb_webusb_get_tuning,
+            dev_handle, endpoint, tuning);
+}
+
+int LIBUSB_CALL libusb_webusb_stream_start(libusb_device_handle *dev_handle,
+    unsigned char endpoint, unsigned char *ring, size_t ring_size,
+    int transfer_size, int transfers, struct libusb_webusb_stream **stream) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    return WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_IIIIIIII, _libusb_webusb_stream_start,
+            dev_handle, endpoint, ring, ring_size, transfer_size, transfers, stream);
+}
+
+int LIBUSB_CALL libusb_webusb_stream_stop(struct libusb_webusb_stream *stream) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    return WORKER_CALL(hc(stream->dev_handle)->worker, EM_FUNC_SIG_II, _libusb_webusb_stream_stop,
+            stream);
+}
+
+int LIBUSB_CALL libusb_interrupt_transfer(libusb_device_handle *dev_handle,
+    unsigned char endpoint, unsigned char *data, int length,
+    int *actual_length, unsigned int timeout) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    int transferred = 0;
+    int r = WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_IIIIIII, _libusb_interrupt_transfer,
+            dev_handle, endpoint, data, length, &transferred, timeout);
+
+    if (actual_length)
+        *actual_length = transferred;
+
+    return r;
 }
 
 int LIBUSB_CALL libusb_clear_halt(libusb_device_handle *dev_handle, unsigned char endpoint) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    return emscripten_dispatch_to_thread_sync(wc(dev_handle)->worker, EM_FUNC_SIG_III, _libusb_clear_halt, nullptr,
-            nullptr, endpoint);
+    return WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_III, _libusb_clear_halt,
+            dev_handle, endpoint);
+}
+
+int webusb_resubmit_transfer(struct libusb_transfer *transfer) {
+    int result;
+    _Atomic uint32_t done = 0;
+
+    if (push_command(hc(transfer->dev_handle), worker_command{WORKER_COMMAND_SUBMIT, transfer, &result, &done, nullptr, 0},
+                CALL_STATS(_libusb_submit_transfer))) {
+        while (!done)
+            emscripten_futex_wait(&done, 0, INFINITY);
+        return result;
+    }
+
+    return WORKER_CALL(hc(transfer->dev_handle)->worker, EM_FUNC_SIG_II, _libusb_submit_transfer,
+            transfer);
 }
 
 int LIBUSB_CALL libusb_submit_transfer(struct libusb_transfer *transfer) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    return emscripten_dispatch_to_thread_sync(wc(transfer->dev_handle)->worker, EM_FUNC_SIG_II, _libusb_submit_transfer, nullptr,
-            transfer);
+    tc(transfer)->cancel_requested = false;
+    return webusb_resubmit_transfer(transfer);
+}
+
+int LIBUSB_CALL libusb_webusb_submit_transfers(struct libusb_transfer **transfers, int count) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    if (count <= 0)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    handle_context* h = hc(transfers[0]->dev_handle);
+    for (int i = 1; i < count; i++) {
+        if (!pthread_equal(hc(transfers[i]->dev_handle)->worker, h->worker))
+            return LIBUSB_ERROR_INVALID_PARAM;
+    }
+
+    for (int i = 0; i < count; i++)
+        tc(transfers[i])->cancel_requested = false;
+
+    int result;
+    _Atomic uint32_t done = 0;
+
+    if (push_command(h, worker_command{WORKER_COMMAND_SUBMIT_MANY, nullptr, &result, &done, transfers, count},
+                CALL_STATS(_libusb_webusb_submit_transfers))) {
+        while (!done)
+            emscripten_futex_wait(&done, 0, INFINITY);
+        return result;
+    }
+
+    return WORKER_CALL(h->worker, EM_FUNC_SIG_III, _libusb_webusb_submit_transfers,
+            transfers, count);
+}
+
+int LIBUSB_CALL libusb_webusb_set_batch_callback(libusb_device_handle *dev_handle,
+    unsigned char endpoint, libusb_webusb_batch_cb_fn callback, void *user_data) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    return WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_IIIII, _libusb_webusb_set_batch_callback,
+            dev_handle, endpoint, callback, user_data);
 }
 
 int LIBUSB_CALL libusb_reset_device(libusb_device_handle *dev_handle) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    return emscripten_dispatch_to_thread_sync(wc(dev_handle)->worker, EM_FUNC_SIG_II, _libusb_reset_device, nullptr,
-            nullptr);
+    int r = WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_II, _libusb_reset_device,
+            dev_handle);
+
+    update_active_config(hc(dev_handle)->dev, hc(dev_handle)->worker);
+    return r;
 }
 
 int LIBUSB_CALL libusb_kernel_driver_active(libusb_device_handle *dev_handle, int interface_number) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    return emscripten_dispatch_to_thread_sync(wc(dev_handle)->worker, EM_FUNC_SIG_III, _libusb_kernel_driver_active, nullptr,
-            nullptr, interface_number);
+    return WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_III, _libusb_kernel_driver_active,
+            dev_handle, interface_number);
 }
 
 int LIBUSB_CALL libusb_cancel_transfer(struct libusb_transfer *transfer) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    return emscripten_dispatch_to_thread_sync(wc(transfer->dev_handle)->worker, EM_FUNC_SIG_II, _libusb_cancel_transfer, nullptr,
-            transfer);
+    // A completed transfer whose callback has not returned yet cannot be
+    // cancelled any more, but must not be auto-resubmitted either. The bit is
+    // set first, so a resubmit racing with this call still sees it on its
+    // next completion.
+    bool in_flight = tc(transfer)->in_flight;
+    if (!in_flight && (tc(transfer)->delivery & ~DELIVERY_FREED) == DELIVERY_NONE)
+        return LIBUSB_ERROR_NOT_FOUND;
+
+    tc(transfer)->cancel_requested = true;
+
+    if (!tc(transfer)->in_flight)
+        return LIBUSB_SUCCESS;
+
+    // The cancelled completion is delivered by a handle_events call once the
+    // worker ran the cancel.
+    if (!push_command(hc(transfer->dev_handle), worker_command{WORKER_COMMAND_CANCEL, transfer, nullptr, nullptr, nullptr, 0},
+                CALL_STATS(_libusb_cancel_transfer)))
+        WORKER_POST(hc(transfer->dev_handle)->worker, EM_FUNC_SIG_II, _libusb_cancel_transfer,
+                transfer);
+
+    return LIBUSB_SUCCESS;
 }
 
 void LIBUSB_CALL libusb_free_transfer(struct libusb_transfer *transfer) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    emscripten_dispatch_to_thread_sync(wc(transfer->dev_handle)->worker, EM_FUNC_SIG_VI, _libusb_free_transfer, nullptr,
-            transfer);
+    if (!transfer)
+        return;
+
+    // Only transfers still known to the worker need it to forget them first.
+    if (!tc(transfer)->in_flight) {
+        _libusb_free_transfer(transfer);
+        return;
+    }
+
+    if (!push_command(hc(transfer->dev_handle), worker_command{WORKER_COMMAND_FREE, transfer, nullptr, nullptr, nullptr, 0},
+                CALL_STATS(_libusb_free_transfer)))
+        WORKER_POST(hc(transfer->dev_handle)->worker, EM_FUNC_SIG_VI, _libusb_free_transfer,
+                transfer);
 }
 
 int LIBUSB_CALL libusb_handle_events_timeout(libusb_context *ctx, struct timeval *tv) {
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    return emscripten_dispatch_to_thread_sync(wc(ctx)->worker, EM_FUNC_SIG_III, _libusb_handle_events_timeout, nullptr,
-            ctx, tv);
+    return libusb_handle_events_timeout_completed(ctx, tv, nullptr);
+}
+
+// Sleep until a completion is ready for delivery, *completed is set, or the
+// timeout expires. The worker must keep running its event loop to resolve
+// WebUSB promises and the main browser thread cannot block, so both return
+// straight away.
+static void wait_for_events(webusb_context* ctx, struct timeval *tv, int *completed);
+
+// With a callback thread, handle_events only waits until *completed is set
+// or, without completed, until some callback was delivered. The callback
+// thread itself must not wait for its own deliveries.
+static void wait_for_callbacks(webusb_context* ctx, struct timeval *tv, int *completed) {
+    if (pthread_equal(pthread_self(), ctx->callback_thread) || pthread_equal(pthread_self(), ctx->worker) ||
+        emscripten_is_main_browser_thread())
+        return;
+
+    uint32_t delivered = ctx->completions_delivered;
+
+    double deadline = INFINITY;
+    if (tv)
+        deadline = emscripten_get_now() + tv->tv_sec * 1000.0 + tv->tv_usec / 1000.0;
+
+    for (;;) {
+        uint32_t seq = ctx->event_seq;
+
+        if (completed ? *completed : ctx->completions_delivered != delivered)
+            return;
+
+        double remaining = deadline - emscripten_get_now();
+        if (remaining <= 0)
+            return;
+
+        emscripten_futex_wait(&ctx->event_seq, seq, remaining);
+    }
+}
+
+static void wait_for_events(webusb_context* ctx, struct timeval *tv, int *completed) {
+    if (pthread_equal(pthread_self(), ctx->worker) || emscripten_is_main_browser_thread())
+        return;
+
+    double deadline = INFINITY;
+    if (tv)
+        deadline = emscripten_get_now() + tv->tv_sec * 1000.0 + tv->tv_usec / 1000.0;
+
+    for (;;) {
+        uint32_t seq = ctx->event_seq;
+
+        if (ctx->completions_pushed != ctx->completions_delivered)
+            return;
+        if (completed && *completed)
+            return;
+
+        double remaining = deadline - emscripten_get_now();
+        if (remaining <= 0)
+            return;
+
+        emscripten_futex_wait(&ctx->event_seq, seq, remaining);
+    }
 }
 
 int LIBUSB_CALL libusb_handle_events_timeout_completed(libusb_context *ctx,
@@ -282,8 +1197,22 @@ int LIBUSB_CALL libusb_handle_events_timeout_completed(libusb_context *ctx,
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    return emscripten_dispatch_to_thread_sync(_ctx->worker, EM_FUNC_SIG_IIII, _libusb_handle_events_timeout_completed, nullptr,
-            nullptr, tv, completed);
+    webusb_context* c = ctx_of(ctx);
+    if (!c)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    if (c->consumer == CONSUMER_CALLBACK_THREAD) {
+        wait_for_callbacks(c, tv, completed);
+        return LIBUSB_SUCCESS;
+    }
+
+    wait_for_events(c, tv, completed);
+
+    if (c->completions_pushed == c->completions_delivered)
+        return LIBUSB_SUCCESS;
+
+    return WORKER_CALL(c->worker, EM_FUNC_SIG_IIII, _libusb_handle_events_timeout_completed,
+            (libusb_context*)c, tv, completed);
 }
 
 int LIBUSB_CALL libusb_set_interface_alt_setting(libusb_device_handle *dev_handle,
@@ -291,8 +1220,8 @@ int LIBUSB_CALL libusb_set_interface_alt_setting(libusb_device_handle *dev_handl
 #ifdef DEBUG_TRACE
     std::cout << "> " << __func__ << std::endl;
 #endif
-    return emscripten_dispatch_to_thread_sync(wc(dev_handle)->worker, EM_FUNC_SIG_IIII, _libusb_set_interface_alt_setting, nullptr,
-            nullptr, interface_number, alternate_setting);
+    return WORKER_CALL(hc(dev_handle)->worker, EM_FUNC_SIG_IIII, _libusb_set_interface_alt_setting,
+            dev_handle, interface_number, alternate_setting);
 }
 
 //
@@ -313,6 +1242,82 @@ struct libusb_transfer * LIBUSB_CALL libusb_alloc_transfer(int iso_packets) {
     return _libusb_alloc_transfer(iso_packets);
 }
 
+unsigned char * LIBUSB_CALL libusb_dev_mem_alloc(libusb_device_handle *dev_handle, size_t length) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    return _libusb_dev_mem_alloc(dev_handle, length);
+}
+
+int LIBUSB_CALL libusb_dev_mem_free(libusb_device_handle *dev_handle, unsigned char *buffer, size_t length) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    return _libusb_dev_mem_free(dev_handle, buffer, length);
+}
+
+void LIBUSB_CALL libusb_webusb_get_pool_stats(struct libusb_webusb_pool_stats *stats) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    _libusb_webusb_get_pool_stats(stats);
+}
+
+size_t LIBUSB_CALL libusb_webusb_stream_read(struct libusb_webusb_stream *stream,
+    unsigned char *data, size_t length, unsigned int timeout) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    uint32_t tail = stream->tail;
+    uint32_t head = stream->head;
+
+    // Same restrictions as wait_for_events().
+    if (head == tail && timeout && !stream->error &&
+        !pthread_equal(pthread_self(), hc(stream->dev_handle)->worker) && !emscripten_is_main_browser_thread()) {
+        emscripten_futex_wait(&stream->head, head, timeout);
+        head = stream->head;
+    }
+
+    size_t len = std::min((size_t)(head - tail), length);
+    uint32_t pos = tail & (stream->size - 1);
+    size_t first = std::min(len, (size_t)(stream->size - pos));
+
+    memcpy(data, stream->ring + pos, first);
+    memcpy(data + first, stream->ring, len - first);
+
+    stream->tail = tail + len;
+
+    return len;
+}
+
+void LIBUSB_CALL libusb_webusb_stream_get_stats(struct libusb_webusb_stream *stream,
+    struct libusb_webusb_stream_stats *stats) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    stats->bytes = stream->bytes;
+    stats->dropped = stream->dropped;
+    stats->overruns = stream->overruns;
+    stats->error = stream->error;
+}
+
+int LIBUSB_CALL libusb_webusb_get_call_stats(struct libusb_webusb_call_stats *stats, int count) {
+#ifdef DEBUG_TRACE
+    std::cout << "> " << __func__ << std::endl;
+#endif
+    std::lock_guard<std::mutex> lock(call_stats_lock);
+
+    int n = call_stats_list.size();
+    for (int i = 0; i < std::min(n, count); i++) {
+        stats[i].name = call_stats_list[i]->name;
+        stats[i].direct = call_stats_list[i]->direct;
+        stats[i].proxied = call_stats_list[i]->proxied;
+        stats[i].queued = call_stats_list[i]->queued;
+    }
+
+    return n;
+}
+
 static void LIBUSB_CALL sync_transfer_cb(struct libusb_transfer *transfer)
 {
 	int *completed = (int*) transfer->user_data;
@@ -326,7 +1331,7 @@ static void sync_transfer_wait_for_completion(struct libusb_transfer *transfer)
     int *completed = (int*)transfer->user_data;
 
 	while (!*completed) {
-		r = libusb_handle_events_completed(NULL, completed);
+		r = libusb_handle_events_completed((libusb_context*)hc(transfer->dev_handle)->ctx, completed);
 		if (r < 0) {
 			if (r == LIBUSB_ERROR_INTERRUPTED)
 				continue;
@@ -359,6 +1364,7 @@ static int do_sync_bulk_transfer(struct libusb_device_handle *dev_handle,
 	libusb_fill_bulk_transfer(transfer, dev_handle, endpoint, buffer, length,
 		sync_transfer_cb, &completed, timeout);
 	transfer->type = type;
+	tc(transfer)->sync = true;
 
 	r = libusb_submit_transfer(transfer);
 	if (r < 0) {
@@ -416,6 +1422,13 @@ int LIBUSB_CALL libusb_handle_events_completed(
     return libusb_handle_events_timeout_completed(ctx, &tv, completed);
 }
 
+int LIBUSB_CALL libusb_handle_events(libusb_context *ctx) {
+    struct timeval tv;
+    tv.tv_sec = 60;
+    tv.tv_usec = 0;
+    return libusb_handle_events_timeout_completed(ctx, &tv, nullptr);
+}
+
 int LIBUSB_CALL libusb_bulk_transfer(libusb_device_handle *dev_handle,
     unsigned char endpoint, unsigned char *data, int length,
                                      int *actual_length, unsigned int timeout) {
@@ -1,14 +1,26 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <iterator>
+#include <algorithm>
 #include <mutex>
+#include <cstring>
+#include <map>
+#include <set>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <climits>
+#include <cmath>
 
 #include <emscripten.h>
+#include <emscripten/bind.h>
 #include <emscripten/val.h>
 #include <emscripten/threading.h>
+#include <emscripten/atomic.h>
+#include <emscripten/eventloop.h>
 
 #include "interface.h"
+#include "ring.h"
 
 using namespace emscripten;
 
@@ -16,9 +28,23 @@ using namespace emscripten;
 #define LIBUSB_PRODUCT_ID       ((uint8_t)2)
 #define LIBUSB_SN_ID            ((uint8_t)3)
 
-std::mutex mutex;
-std::vector<struct libusb_transfer*> transfers;
-std::vector<struct libusb_transfer*> staging;
+// Round the private header up so the libusb_transfer behind it stays aligned.
+#define TRANSFER_CONTEXT_SIZE \
+    ((sizeof(transfer_context) + alignof(struct libusb_transfer) - 1) & \
+     ~(alignof(struct libusb_transfer) - 1))
+
+static void signal_event(webusb_context* ctx) {
+    ctx->event_seq++;
+    emscripten_futex_wake(&ctx->event_seq, INT_MAX);
+}
+
+handle_context* hc(libusb_device_handle* dev_handle) {
+    return (handle_context*)dev_handle;
+}
+
+transfer_context* tc(struct libusb_transfer* transfer) {
+    return (transfer_context*)((uint8_t*)transfer - TRANSFER_CONTEXT_SIZE);
+}
 
 val create_out_buffer(uint8_t* buffer, size_t size) {
     val buf = val::global("Uint8Array").new_(size);
@@ -27,6 +53,405 @@ val create_out_buffer(uint8_t* buffer, size_t size) {
     return buf;
 }
 
+//
+// Device memory arena.
+//
+// libusb_dev_mem_alloc() hands out buffers carved from large chunks of the
+// wasm heap, aligned to the largest endpoint packet size of the handle's
+// device. Freed buffers go back on a free list by size and are reused by the
+// next allocation, so repeated start/stop cycles do not grow the heap.
+// Chunks are never released, which lets the worker keep one Uint8Array per
+// chunk and copy completions into arena buffers without building a new view
+// each time.
+//
+// The chunk table only grows: an entry is filled in before the count and the
+// arena's address range publish it, so completions find their chunk without
+// taking the lock.
+//
+
+#define ARENA_CHUNK_SIZE    (4 * 1024 * 1024)
+#define ARENA_MAX_CHUNKS    1024
+
+// Packet size assumed until the device's configuration says otherwise.
+#define DEFAULT_PACKET_SIZE 512
+
+typedef struct {
+    uint8_t* base;
+    size_t size;
+    size_t used;        // under arena_lock
+} arena_chunk;
+
+static std::mutex arena_lock;
+static arena_chunk arena_chunks[ARENA_MAX_CHUNKS];
+static _Atomic int arena_chunk_count = 0;
+static _Atomic uintptr_t arena_lo = UINTPTR_MAX;
+static _Atomic uintptr_t arena_hi = 0;
+static std::multimap<size_t, uint8_t*> arena_free;
+static std::unordered_map<uint8_t*, size_t> arena_used;
+static thread_local std::vector<val> arena_views;
+static thread_local int arena_hint = 0;
+
+static size_t align_up(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static uint8_t* arena_alloc(size_t length, int packet_size) {
+    size_t align = 64;
+    while (align < (size_t)packet_size)
+        align <<= 1;
+
+    size_t size = align_up(std::max(length, (size_t)1), align);
+
+    std::lock_guard<std::mutex> lock(arena_lock);
+
+    for (auto it = arena_free.lower_bound(size); it != arena_free.end() && it->first == size; it++) {
+        if ((uintptr_t)it->second % align)
+            continue;
+        uint8_t* buffer = it->second;
+        arena_free.erase(it);
+        arena_used[buffer] = size;
+        return buffer;
+    }
+
+    int count = arena_chunk_count;
+    arena_chunk* chunk = nullptr;
+    for (int i = 0; i < count; i++) {
+        if (align_up(arena_chunks[i].used, align) + size <= arena_chunks[i].size) {
+            chunk = &arena_chunks[i];
+            break;
+        }
+    }
+
+    if (!chunk) {
+        if (count == ARENA_MAX_CHUNKS)
+            return nullptr;
+
+        size_t chunk_align = std::max(align, (size_t)4096);
+        size_t chunk_size = align_up(std::max(size, (size_t)ARENA_CHUNK_SIZE), chunk_align);
+        uint8_t* base = (uint8_t*)aligned_alloc(chunk_align, chunk_size);
+        if (!base)
+            return nullptr;
+
+        chunk = &arena_chunks[count];
+        *chunk = arena_chunk{base, chunk_size, 0};
+        arena_chunk_count = count + 1;
+        arena_lo = std::min((uintptr_t)arena_lo, (uintptr_t)base);
+        arena_hi = std::max((uintptr_t)arena_hi, (uintptr_t)(base + chunk_size));
+    }
+
+    chunk->used = align_up(chunk->used, align);
+    uint8_t* buffer = chunk->base + chunk->used;
+    chunk->used += size;
+    arena_used[buffer] = size;
+
+    return buffer;
+}
+
+static int arena_free_buffer(uint8_t* buffer) {
+    std::lock_guard<std::mutex> lock(arena_lock);
+
+    auto it = arena_used.find(buffer);
+    if (it == arena_used.end())
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    arena_free.insert(std::make_pair(it->second, buffer));
+    arena_used.erase(it);
+
+    return LIBUSB_SUCCESS;
+}
+
+static bool in_chunk(int index, uint8_t* buffer) {
+    const arena_chunk& chunk = arena_chunks[index];
+    return buffer >= chunk.base && buffer < chunk.base + chunk.size;
+}
+
+// Worker only. Returns the cached view of the arena chunk holding buffer, or
+// null if buffer is not arena memory. Buffers outside the arena are turned
+// away by the range check, and those of the chunk used last by the hint.
+static val* arena_view(uint8_t* buffer, size_t* offset) {
+    if ((uintptr_t)buffer < arena_lo || (uintptr_t)buffer >= arena_hi)
+        return nullptr;
+
+    int count = arena_chunk_count;
+    int index = arena_hint;
+    if (index >= count || !in_chunk(index, buffer)) {
+        for (index = 0; index < count && !in_chunk(index, buffer); index++)
+            ;
+        if (index == count)
+            return nullptr;
+        arena_hint = index;
+    }
+
+    const arena_chunk& chunk = arena_chunks[index];
+
+    while (arena_views.size() <= (size_t)index)
+        arena_views.push_back(val::null());
+
+    // A view is detached if non-shared memory grew since it was created.
+    val& view = arena_views[index];
+    if (view.isNull() || !view["byteLength"].as<bool>())
+        view = val(typed_memory_view(chunk.size, chunk.base));
+
+    *offset = buffer - chunk.base;
+    return &view;
+}
+
+unsigned char * LIBUSB_CALL _libusb_dev_mem_alloc(libusb_device_handle *dev_handle, size_t length) {
+    int packet = dev_handle ? hc(dev_handle)->max_packet_size : 0;
+    return arena_alloc(length, packet ? packet : DEFAULT_PACKET_SIZE);
+}
+
+int LIBUSB_CALL _libusb_dev_mem_free(libusb_device_handle *dev_handle, unsigned char *buffer, size_t length) {
+    return arena_free_buffer(buffer);
+}
+
+// A WebUSB transfer issued for a split transfer, see split_transfer().
+typedef struct {
+    uint32_t id;        // transfer the part was reserved for
+    int length;
+    bool skipped = false;
+    bool done = false;
+    enum libusb_transfer_status status = LIBUSB_TRANSFER_COMPLETED;
+    val data = val::undefined();
+    int received = 0;
+    int pos = 0;        // bytes handed out so far
+    double issued_at = 0;
+} split_part;
+
+// Per-endpoint state, keyed by endpoint address. See split_transfer() and
+// read_ahead() for the split and read-ahead settings.
+typedef struct {
+    int packet_size = 0;
+    int split_size = 0;
+    int read_ahead = 0;
+
+    // Read-ahead buffer and the libusb_bulk_transfer() reads waiting on it.
+    std::vector<uint8_t> ahead;
+    size_t ahead_pos = 0;
+    bool ahead_short = false;
+    bool reading = false;
+    std::deque<uint32_t> waiters;
+
+    // Split parts in the order they were reserved, numbered from next_part
+    // - parts.size(). Parts from next_issue on wait for a free slot when the
+    // number in flight is limited. readers are the split transfers that
+    // consume the parts, in submission order.
+    int depth = 0;
+    int parts_in_flight = 0;
+    std::deque<split_part> parts;
+    uint32_t next_part = 0;
+    uint32_t next_issue = 0;
+    std::deque<uint32_t> readers;
+    int max_length = 0;
+
+    // Completions in the current measurement window.
+    double window_start = 0;
+    double window_latency = 0;
+    uint64_t window_bytes = 0;
+    int window_count = 0;
+    uint32_t throughput = 0;
+    uint32_t latency_us = 0;
+
+    // Auto-tuner, see tune_endpoint().
+    bool autotune = false;
+    bool probing = false;
+    bool settled = false;
+    int tune_dim = 0;
+    int tune_dir = 1;
+    int tune_failures = 0;
+    double best = 0;
+    int prev_split_size = 0;
+    int prev_depth = 0;
+} endpoint_state;
+
+//
+// Handle table.
+//
+// Every worker keeps the devices opened on it in a table indexed by the id
+// stored in the handle, so calls find the USBDevice and the per-handle
+// state without a JS global lookup, and several devices can be open at once.
+//
+
+typedef struct {
+    int id;
+    val device = val::undefined();
+    std::set<int> claimed;
+    std::map<unsigned char, endpoint_state> endpoints;
+    std::map<unsigned char, val> interrupt_polls;   // see interrupt_in_promise()
+
+    // Device operations of calls that are dispatched without waiting for
+    // them (close, release_interface). They run one after another on a
+    // promise chain, and worker entry points that talk to the device settle
+    // the chain first, so they observe the effects.
+    bool ops_queued = false;
+    val ops = val::undefined();
+} device_slot;
+
+static thread_local std::unordered_map<int, device_slot> handles;
+static thread_local int next_handle_id = 0;
+
+// Operation chains of closed handles, settled before the next open.
+static thread_local std::vector<val> closing;
+
+// The USBDevices listed by getDevices() on this worker.
+static thread_local val worker_devices = val::undefined();
+
+static device_slot* slot(int id) {
+    auto it = handles.find(id);
+    return it == handles.end() ? nullptr : &it->second;
+}
+
+static device_slot* slot(libusb_device_handle* dev_handle) {
+    return dev_handle ? slot(hc(dev_handle)->id) : nullptr;
+}
+
+static int packet_size(const endpoint_state& ep) {
+    return ep.packet_size ? ep.packet_size : DEFAULT_PACKET_SIZE;
+}
+
+static unsigned char endpoint_address(val endpoint) {
+    unsigned char address = endpoint["endpointNumber"].as<int>();
+    if (!endpoint["direction"].as<std::string>().compare("in"))
+        address |= LIBUSB_ENDPOINT_IN;
+    return address;
+}
+
+// Endpoint addresses of an interface's current alternate setting.
+static std::vector<unsigned char> interface_endpoints(val device, int interface_number) {
+    std::vector<unsigned char> addresses;
+
+    val config = device["configuration"];
+    if (!config.as<bool>())
+        return addresses;
+
+    val interfaces = config["interfaces"];
+    for (int i = 0; i < interfaces["length"].as<int>(); i++) {
+        if (interfaces[i]["interfaceNumber"].as<int>() != interface_number)
+            continue;
+
+        val eps = interfaces[i]["alternate"]["endpoints"];
+        for (int e = 0; e < eps["length"].as<int>(); e++)
+            addresses.push_back(endpoint_address(eps[e]));
+    }
+
+    return addresses;
+}
+
+static void update_max_packet_size(libusb_device_handle* dev_handle) {
+    device_slot* s = slot(dev_handle);
+    val config = s->device["configuration"];
+    if (!config.as<bool>())
+        return;
+
+    int max = 0;
+    val interfaces = config["interfaces"];
+    for (int i = 0; i < interfaces["length"].as<int>(); i++) {
+        val eps = interfaces[i]["alternate"]["endpoints"];
+        for (int e = 0; e < eps["length"].as<int>(); e++) {
+            val endpoint = eps[e];
+            int size = endpoint["packetSize"].as<int>();
+
+            s->endpoints[endpoint_address(endpoint)].packet_size = size;
+            max = std::max(max, size);
+        }
+    }
+
+    if (max)
+        hc(dev_handle)->max_packet_size = max;
+}
+
+// Copy a WebUSB result DataView into wasm memory with a single typed-array set,
+// honoring the view's offset and length. Returns the number of bytes copied.
+int copy_in_data(val data, unsigned char* buffer, int size) {
+    if (!data.as<bool>())
+        return 0;
+
+    int len = std::min(data["byteLength"].as<int>(), size);
+    val src = val::global("Uint8Array").new_(data["buffer"], data["byteOffset"], len);
+
+    size_t offset;
+    val* view = arena_view(buffer, &offset);
+    if (view) {
+        view->call<void>("set", src, offset);
+    } else {
+        val(typed_memory_view(len, buffer)).call<void>("set", src);
+    }
+
+    return len;
+}
+
+// Browsers that only accept unshared buffers reject views of the (shared)
+// wasm heap with a TypeError. Fall back to copying once that happens.
+static _Atomic bool out_views_supported = true;
+
+// True if err rejected OUT data passed as a view. Views are not used again
+// after that.
+static bool view_rejected(bool view, val err) {
+    if (!view || err["name"].as<std::string>().compare("TypeError"))
+        return false;
+
+    if (out_views_supported)
+        std::cout << "_submit_transfer: shared memory views rejected, copying OUT data" << std::endl;
+    out_views_supported = false;
+
+    return true;
+}
+
+// Pass OUT data to WebUSB as a view of wasm memory, without a copy, unless
+// views were rejected before. *view tells which one was used, so a
+// rejection can be retried with a copy.
+val out_data(unsigned char* buffer, int size, bool* view) {
+    *view = out_views_supported;
+    if (*view)
+        return val(typed_memory_view(size, buffer));
+
+    return create_out_buffer(buffer, size);
+}
+
+// op is called with no arguments of its own and returns a promise.
+static void queue_device_op(device_slot* s, val op) {
+    if (!s->ops_queued)
+        s->ops = val::global("Promise").call<val>("resolve");
+
+    s->ops = s->ops.call<val>("then", op, op);
+    s->ops_queued = true;
+}
+
+static void settle(val ops) {
+    ops.call<val>("catch", val::global("Function").new_()).await();
+}
+
+// Only for worker entry points, since it may await.
+static void settle_device_ops(device_slot* s) {
+    if (!s->ops_queued)
+        return;
+
+    s->ops_queued = false;
+    settle(s->ops);
+}
+
+static void settle_closing() {
+    for (auto& ops : closing)
+        settle(ops);
+    closing.clear();
+}
+
+// The handle's USBDevice once its queued operations are done, or undefined
+// for a handle that is not open.
+static val settled_device(libusb_device_handle* dev_handle) {
+    device_slot* s = slot(dev_handle);
+    if (!s)
+        return val::undefined();
+
+    settle_device_ops(s);
+    return s->device;
+}
+
+bool device_ops_queued(libusb_device_handle* dev_handle) {
+    device_slot* s = slot(dev_handle);
+    return s && s->ops_queued;
+}
+
 int pick_device() {
     val usb = val::global("navigator")["usb"];
 
@@ -56,13 +481,22 @@ int _libusb_init(libusb_context**) {
     return LIBUSB_SUCCESS;
 };
 
+// Devices the page was granted stay listed by getDevices() for every later
+// context, so the chooser is only shown while there are none. It needs a
+// user gesture, which a second init/list cycle usually no longer has.
 ssize_t _libusb_get_device_list(libusb_context *ctx, libusb_device ***list) {
     std::cout << "_libusg_get_device_list" << std::endl;
-    if (emscripten_sync_run_in_main_runtime_thread(EM_FUNC_SIG_I, pick_device) < 0)
-        return LIBUSB_ERROR_NO_DEVICE;
+    val usb = val::global("navigator")["usb"];
 
     std::cout << "navigator get_devices" << std::endl;
-    val devices = val::global("navigator")["usb"].call<val>("getDevices").await();
+    val devices = usb.call<val>("getDevices").await();
+
+    if (devices["length"].as<int>() == 0) {
+        if (emscripten_sync_run_in_main_runtime_thread(EM_FUNC_SIG_I, pick_device) < 0)
+            return LIBUSB_ERROR_NO_DEVICE;
+        devices = usb.call<val>("getDevices").await();
+    }
+
     int available = devices["length"].as<int>();
 
     if (available == 0)
@@ -79,19 +513,32 @@ ssize_t _libusb_get_device_list(libusb_context *ctx, libusb_device ***list) {
     l[available] = nullptr;
     *list = l;
 
-    std::cout << "setting global devices" << std::endl;
-    val::global().set("devices", devices);
+    std::cout << "setting worker devices" << std::endl;
+    worker_devices = devices;
 
     return available;
 }
 
-int _libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc) {
-    val devices = val::global("devices");
+// Look the devices up again on a per-device worker. WebUSB objects belong to
+// the worker that obtained them, and getDevices() lists the devices the page
+// was granted access to in the same order on every worker.
+int _libusb_attach_devices(libusb_context *ctx) {
+    val devices = val::global("navigator")["usb"].call<val>("getDevices").await();
+    int available = devices["length"].as<int>();
+
+    if (available == 0)
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    worker_devices = devices;
+
+    return available;
+}
 
-    if (!devices.as<bool>())
+int _libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc) {
+    if (!worker_devices.as<bool>())
         return LIBUSB_ERROR_INVALID_PARAM;
 
-    val d = devices[*((int*)dev)];
+    val d = worker_devices[*((int*)dev)];
 
     if (!d.as<bool>())
         return LIBUSB_ERROR_INVALID_PARAM;
@@ -117,35 +564,209 @@ int _libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descr
     return LIBUSB_SUCCESS;
 }
 
+//
+// Configuration descriptors.
+//
+// All configurations of a device are built from USBDevice.configurations in
+// one walk and laid out in a single block: the config descriptors, then the
+// interfaces, alternate settings and endpoints they point into. WebUSB does
+// not expose string indices, MaxPower or bInterval, so those are 0.
+//
+
+static uint8_t endpoint_attributes(const std::string& type) {
+    if (!type.compare("isochronous"))
+        return LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
+    if (!type.compare("interrupt"))
+        return LIBUSB_TRANSFER_TYPE_INTERRUPT;
+    return LIBUSB_TRANSFER_TYPE_BULK;
+}
+
+int _libusb_get_config_cache(libusb_device *dev, config_cache **cache) {
+    if (!worker_devices.as<bool>())
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    val d = worker_devices[*((int*)dev)];
+
+    if (!d.as<bool>())
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    // Pointers hold array indices until the block is laid out.
+    std::vector<struct libusb_config_descriptor> configs;
+    std::vector<struct libusb_interface> interfaces;
+    std::vector<struct libusb_interface_descriptor> alts;
+    std::vector<struct libusb_endpoint_descriptor> eps;
+
+    val configurations = d["configurations"];
+    for (int c = 0; c < configurations["length"].as<int>(); c++) {
+        val config = configurations[c];
+        val ifaces = config["interfaces"];
+        int total = LIBUSB_DT_CONFIG_SIZE;
+
+        struct libusb_config_descriptor cd = {};
+        cd.bLength = LIBUSB_DT_CONFIG_SIZE;
+        cd.bDescriptorType = LIBUSB_DT_CONFIG;
+        cd.bNumInterfaces = ifaces["length"].as<uint8_t>();
+        cd.bConfigurationValue = config["configurationValue"].as<uint8_t>();
+        cd.bmAttributes = 0x80;
+        cd.interface = (const struct libusb_interface*)interfaces.size();
+
+        for (int i = 0; i < cd.bNumInterfaces; i++) {
+            val iface = ifaces[i];
+            val alternates = iface["alternates"];
+
+            struct libusb_interface in = {};
+            in.num_altsetting = alternates["length"].as<int>();
+            in.altsetting = (const struct libusb_interface_descriptor*)alts.size();
+            interfaces.push_back(in);
+
+            for (int a = 0; a < in.num_altsetting; a++) {
+                val alt = alternates[a];
+                val endpoints = alt["endpoints"];
+
+                struct libusb_interface_descriptor id = {};
+                id.bLength = LIBUSB_DT_INTERFACE_SIZE;
+                id.bDescriptorType = LIBUSB_DT_INTERFACE;
+                id.bInterfaceNumber = iface["interfaceNumber"].as<uint8_t>();
+                id.bAlternateSetting = alt["alternateSetting"].as<uint8_t>();
+                id.bNumEndpoints = endpoints["length"].as<uint8_t>();
+                id.bInterfaceClass = alt["interfaceClass"].as<uint8_t>();
+                id.bInterfaceSubClass = alt["interfaceSubclass"].as<uint8_t>();
+                id.bInterfaceProtocol = alt["interfaceProtocol"].as<uint8_t>();
+                id.endpoint = (const struct libusb_endpoint_descriptor*)eps.size();
+                alts.push_back(id);
+                total += LIBUSB_DT_INTERFACE_SIZE;
+
+                for (int e = 0; e < id.bNumEndpoints; e++) {
+                    val endpoint = endpoints[e];
+
+                    struct libusb_endpoint_descriptor ed = {};
+                    ed.bLength = LIBUSB_DT_ENDPOINT_SIZE;
+                    ed.bDescriptorType = LIBUSB_DT_ENDPOINT;
+                    ed.bEndpointAddress = endpoint_address(endpoint);
+                    ed.bmAttributes = endpoint_attributes(endpoint["type"].as<std::string>());
+                    ed.wMaxPacketSize = endpoint["packetSize"].as<uint16_t>();
+                    eps.push_back(ed);
+                    total += LIBUSB_DT_ENDPOINT_SIZE;
+                }
+            }
+        }
+
+        cd.wTotalLength = total;
+        configs.push_back(cd);
+    }
+
+    size_t size = sizeof(config_cache) +
+        configs.size() * sizeof(struct libusb_config_descriptor) +
+        interfaces.size() * sizeof(struct libusb_interface) +
+        alts.size() * sizeof(struct libusb_interface_descriptor) +
+        eps.size() * sizeof(struct libusb_endpoint_descriptor);
+
+    config_cache* block = (config_cache*)malloc(size);
+    if (!block)
+        return LIBUSB_ERROR_NO_MEM;
+
+    auto config_base = (struct libusb_config_descriptor*)(block + 1);
+    auto interface_base = (struct libusb_interface*)(config_base + configs.size());
+    auto alt_base = (struct libusb_interface_descriptor*)(interface_base + interfaces.size());
+    auto ep_base = (struct libusb_endpoint_descriptor*)(alt_base + alts.size());
+
+    block->num_configs = configs.size();
+    block->configs = config_base;
+
+    for (size_t i = 0; i < configs.size(); i++) {
+        config_base[i] = configs[i];
+        config_base[i].interface = interface_base + (uintptr_t)configs[i].interface;
+    }
+    for (size_t i = 0; i < interfaces.size(); i++) {
+        interface_base[i] = interfaces[i];
+        interface_base[i].altsetting = alt_base + (uintptr_t)interfaces[i].altsetting;
+    }
+    for (size_t i = 0; i < alts.size(); i++) {
+        alt_base[i] = alts[i];
+        alt_base[i].endpoint = ep_base + (uintptr_t)alts[i].endpoint;
+    }
+    std::copy(eps.begin(), eps.end(), ep_base);
+
+    *cache = block;
+
+    return LIBUSB_SUCCESS;
+}
+
+int _libusb_get_active_config_value(libusb_device *dev) {
+    if (!worker_devices.as<bool>())
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    val d = worker_devices[*((int*)dev)];
+
+    if (!d.as<bool>())
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    val config = d["configuration"];
+    if (!config.as<bool>())
+        return LIBUSB_ERROR_NOT_FOUND;
+
+    return config["configurationValue"].as<int>();
+}
+
 void _libusb_free_device_list(libusb_device **list, int unref_devices) {
     free(list);
 }
 
+static void cancel_handle_transfers(libusb_device_handle *dev_handle);
+
+// *dev_handle is allocated by the caller; this fills in its table slot.
 int LIBUSB_CALL _libusb_open(libusb_device *dev, libusb_device_handle **dev_handle) {
-    val device = val::global("devices")[*((int*)dev)];
+    settle_closing();
+
+    if (!worker_devices.as<bool>())
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    val device = worker_devices[*((int*)dev)];
 
     if (!device.as<bool>())
         return LIBUSB_ERROR_NO_DEVICE;
 
     device.call<val>("open").await();
 
-    val::global().set("device", device);
+    int id = ++next_handle_id;
+    device_slot* s = &handles[id];
+    s->id = id;
+    s->device = device;
+
+    hc(*dev_handle)->id = id;
+    update_max_packet_size(*dev_handle);
 
     return LIBUSB_SUCCESS;
 }
 
 void LIBUSB_CALL _libusb_close(libusb_device_handle *dev_handle) {
-    val device = val::global("device");
+    device_slot* s = slot(dev_handle);
 
-    if (!device.as<bool>())
+    if (!s)
         return;
 
-    device.call<val>("close").await();
+    cancel_handle_transfers(dev_handle);
+
+    // Other handles of the device keep it open.
+    bool last = true;
+    for (auto& entry : handles) {
+        if (entry.first != s->id && entry.second.device.strictlyEquals(s->device))
+            last = false;
+    }
+
+    if (last) {
+        queue_device_op(s, s->device["close"].call<val>("bind", s->device));
+        closing.push_back(s->ops);
+    }
+    handles.erase(s->id);
+
+    // Freed once the cancelled completions above were delivered.
+    release_handle(hc(dev_handle));
 }
 
 int LIBUSB_CALL _libusb_get_string_descriptor_ascii(libusb_device_handle *dev_handle,
     uint8_t desc_index, unsigned char *data, int length) {
-    val device = val::global("device");
+    val device = settled_device(dev_handle);
 
     if (!device.as<bool>())
         return LIBUSB_ERROR_NO_DEVICE;
@@ -170,52 +791,57 @@ int LIBUSB_CALL _libusb_get_string_descriptor_ascii(libusb_device_handle *dev_ha
 }
 
 int LIBUSB_CALL _libusb_set_configuration(libusb_device_handle *dev_handle, int configuration) {
-    val device = val::global("device");
+    val device = settled_device(dev_handle);
 
     if (!device.as<bool>())
         return LIBUSB_ERROR_NO_DEVICE;
 
     device.call<val>("selectConfiguration", configuration).await();
+    update_max_packet_size(dev_handle);
 
     return LIBUSB_SUCCESS;
 }
 
 int LIBUSB_CALL _libusb_claim_interface(libusb_device_handle *dev_handle, int interface_number) {
-    val device = val::global("device");
+    val device = settled_device(dev_handle);
 
     if (!device.as<bool>())
         return LIBUSB_ERROR_NO_DEVICE;
 
     device.call<val>("claimInterface", interface_number).await();
+    slot(dev_handle)->claimed.insert(interface_number);
 
     return LIBUSB_SUCCESS;
 }
 
 int LIBUSB_CALL _libusb_release_interface(libusb_device_handle *dev_handle, int interface_number) {
-    val device = val::global("device");
+    device_slot* s = slot(dev_handle);
 
-    if (!device.as<bool>())
+    if (!s)
         return LIBUSB_ERROR_NO_DEVICE;
 
-    device.call<val>("releaseInterface", interface_number).await();
+    if (!s->claimed.erase(interface_number))
+        return LIBUSB_ERROR_NOT_FOUND;
 
-    return LIBUSB_SUCCESS;
-}
+    // Armed polls of the interface's endpoints settle unseen, their
+    // rejection is already handled.
+    for (unsigned char endpoint : interface_endpoints(s->device, interface_number))
+        s->interrupt_polls.erase(endpoint);
 
-int LIBUSB_CALL _libusb_control_transfer(libusb_device_handle *dev_handle,
-    uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
-    unsigned char *data, uint16_t wLength, unsigned int timeout) {
-    val device = val::global("device");
+    queue_device_op(s, s->device["releaseInterface"].call<val>("bind", s->device, interface_number));
 
-    if (!device.as<bool>())
-        return LIBUSB_ERROR_NO_DEVICE;
+    return LIBUSB_SUCCESS;
+}
 
+// Build the WebUSB setup dictionary for a control request. Returns null for
+// the reserved request type, which WebUSB cannot express.
+static val create_setup(uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex) {
     val setup = val::object();
     setup.set("request", bRequest);
     setup.set("value", wValue);
     setup.set("index", wIndex);
 
-    switch ((request_type & 0x31)) {
+    switch ((request_type & 0x1f)) {
         case LIBUSB_RECIPIENT_DEVICE:
             setup.set("recipient", std::string("device"));
             break;
@@ -241,19 +867,40 @@ int LIBUSB_CALL _libusb_control_transfer(libusb_device_handle *dev_handle,
             setup.set("requestType", std::string("vendor"));
             break;
         case LIBUSB_REQUEST_TYPE_RESERVED:
-            return LIBUSB_ERROR_INVALID_PARAM;
+            return val::null();
     }
 
+    return setup;
+}
+
+// Decode the 8-byte setup packet at the head of a control transfer's buffer.
+static val create_setup(struct libusb_transfer* transfer) {
+    auto setup = libusb_control_transfer_get_setup(transfer);
+
+    return create_setup(setup->bmRequestType, setup->bRequest,
+            libusb_le16_to_cpu(setup->wValue), libusb_le16_to_cpu(setup->wIndex));
+}
+
+int LIBUSB_CALL _libusb_control_transfer(libusb_device_handle *dev_handle,
+    uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+    unsigned char *data, uint16_t wLength, unsigned int timeout) {
+    val device = settled_device(dev_handle);
+
+    if (!device.as<bool>())
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    val setup = create_setup(request_type, bRequest, wValue, wIndex);
+
+    if (setup.isNull())
+        return LIBUSB_ERROR_INVALID_PARAM;
+
     if ((request_type & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN) {
         val res = device.call<val>("controlTransferIn", setup, wLength).await();
 
         if (res["status"].as<std::string>().compare("ok"))
             return LIBUSB_ERROR_IO;
 
-        auto buf = res["data"]["buffer"].as<std::string>();
-        std::copy(buf.begin(), buf.end(), data);
-
-        return res["data"]["buffer"]["byteLength"].as<int>();
+        return copy_in_data(res["data"], data, wLength);
     }
 
     if ((request_type & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_OUT) {
@@ -269,136 +916,1543 @@ int LIBUSB_CALL _libusb_control_transfer(libusb_device_handle *dev_handle,
     return LIBUSB_ERROR_OTHER;
 }
 
-struct libusb_transfer * LIBUSB_CALL _libusb_alloc_transfer(int iso_packets) {
-    size_t alloc_size =
-		sizeof(struct libusb_transfer) +
-		(sizeof(struct libusb_iso_packet_descriptor) * (size_t)iso_packets);
+//
+// Transfer pool.
+//
+// Freed transfers are kept on per-size-class free lists, keyed by the number
+// of iso packet descriptors rounded up to a power of two (0, 1, 2, 4 ... 256).
+// Allocating and freeing only takes the class lock, so it is safe on any
+// thread and needs no round trip to the worker.
+//
+
+#define TRANSFER_POOL_CLASSES   10
+#define TRANSFER_POOL_DEPTH     64
+
+typedef struct {
+    std::mutex lock;
+    std::vector<transfer_context*> free;
+} transfer_pool;
+
+static transfer_pool pools[TRANSFER_POOL_CLASSES];
+static _Atomic uint32_t pool_hits = 0;
+static _Atomic uint32_t pool_misses = 0;
+
+static int pool_class(int iso_packets) {
+    int cls = 0;
+    while (cls < TRANSFER_POOL_CLASSES && iso_packets > (cls ? 1 << (cls - 1) : 0))
+        cls++;
+    return cls < TRANSFER_POOL_CLASSES ? cls : -1;
+}
 
-    return (struct libusb_transfer*)malloc(alloc_size);
+static size_t transfer_alloc_size(int iso_packets) {
+    return TRANSFER_CONTEXT_SIZE +
+        sizeof(struct libusb_transfer) +
+        (sizeof(struct libusb_iso_packet_descriptor) * (size_t)iso_packets);
 }
 
-int LIBUSB_CALL _libusb_clear_halt(libusb_device_handle *dev_handle, unsigned char endpoint) {
-    val device = val::global("device");
+struct libusb_transfer * LIBUSB_CALL _libusb_alloc_transfer(int iso_packets) {
+    if (iso_packets < 0)
+        return nullptr;
+
+    int cls = pool_class(iso_packets);
+    int capacity = cls > 0 ? 1 << (cls - 1) : iso_packets;
+    transfer_context* ctx = nullptr;
+
+    if (cls >= 0) {
+        std::lock_guard<std::mutex> lock(pools[cls].lock);
+        if (!pools[cls].free.empty()) {
+            ctx = pools[cls].free.back();
+            pools[cls].free.pop_back();
+        }
+    }
 
-    if (!device.as<bool>())
-        return LIBUSB_ERROR_NO_DEVICE;
+    size_t alloc_size = transfer_alloc_size(capacity);
 
-    std::string direction = ((endpoint & LIBUSB_ENDPOINT_DIR_MASK) & LIBUSB_ENDPOINT_OUT) ? "out" : "in";
-    unsigned char num = endpoint & ~LIBUSB_ENDPOINT_DIR_MASK;
+    if (ctx) {
+        pool_hits++;
+        memset(ctx, 0, alloc_size);
+    } else {
+        pool_misses++;
+        ctx = (transfer_context*)calloc(1, alloc_size);
+        if (!ctx)
+            return nullptr;
+    }
 
-    device.call<val>("clearHalt", direction, num).await();
+    ctx->iso_capacity = capacity;
 
-    return LIBUSB_SUCCESS;
+    return (struct libusb_transfer*)((uint8_t*)ctx + TRANSFER_CONTEXT_SIZE);
 }
 
-int LIBUSB_CALL _libusb_submit_transfer(struct libusb_transfer *transfer) {
-    val device = val::global("device");
-
-    if (!device.as<bool>()) {
-        std::cout << "_submit_transfer: no device" << std::endl;
-        return LIBUSB_ERROR_NO_DEVICE;
-    }
+static void release_transfer(struct libusb_transfer* transfer) {
+    transfer_context* ctx = tc(transfer);
+    int cls = pool_class(ctx->iso_capacity);
 
-    {
-        std::lock_guard<std::mutex> lock(mutex);
-        staging.push_back(transfer);
+    if (cls >= 0) {
+        std::lock_guard<std::mutex> lock(pools[cls].lock);
+        if (pools[cls].free.size() < TRANSFER_POOL_DEPTH) {
+            pools[cls].free.push_back(ctx);
+            return;
+        }
     }
 
-    unsigned char num = transfer->endpoint & ~LIBUSB_ENDPOINT_DIR_MASK;
-    if ((transfer->endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN) {
-        switch(transfer->type) {
-            case LIBUSB_TRANSFER_TYPE_BULK: {
-                val res = device.call<val>("transferIn", num, transfer->length).await();
-
-                if (res["status"].as<std::string>().compare("ok")) {
-                    std::cout << "_submit_transfer: status not ok: " << res["status"].as<std::string>() << std::endl;
-                    return LIBUSB_ERROR_IO;
-                }
-
-                auto buf = res["data"]["buffer"].as<std::string>();
-                std::copy(buf.begin(), buf.end(), transfer->buffer);
+    free(ctx);
+}
 
-                transfer->actual_length = res["data"]["buffer"]["byteLength"].as<int>();
-                if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
-                    transfer->status = LIBUSB_TRANSFER_COMPLETED;
-                }
+// Release a transfer once it left the completion ring. If its completion is
+// still queued or being delivered, the consumer releases it instead.
+static void release_when_delivered(struct libusb_transfer* transfer) {
+    transfer_context* ctx = tc(transfer);
+    uint32_t state = ctx->delivery;
 
-                return LIBUSB_SUCCESS;
-            }
-            case LIBUSB_TRANSFER_TYPE_BULK_STREAM:
-                std::cout << "Not implemented: IN LIBUSB_TRANSFER_TYPE_BULK_STREAM" << std::endl;
-                return LIBUSB_ERROR_NOT_SUPPORTED;
-            case LIBUSB_TRANSFER_TYPE_CONTROL:
-                std::cout << "Not implemented: IN LIBUSB_TRANSFER_TYPE_CONTROL" << std::endl;
-                return LIBUSB_ERROR_NOT_SUPPORTED;
-            case LIBUSB_TRANSFER_TYPE_INTERRUPT:
-                std::cout << "Not implemented: IN LIBUSB_TRANSFER_TYPE_INTERRUPT" << std::endl;
-                return LIBUSB_ERROR_NOT_SUPPORTED;
-            case LIBUSB_TRANSFER_TYPE_ISOCHRONOUS:
-                std::cout << "Not implemented: IN LIBUSB_TRANSFER_TYPE_ISOCHRONOUS" << std::endl;
-                return LIBUSB_ERROR_NOT_SUPPORTED;
+    for (;;) {
+        if (state == DELIVERY_NONE) {
+            release_transfer(transfer);
+            return;
         }
-    }
 
-    if ((transfer->endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_OUT) {
-        switch(transfer->type) {
-            case LIBUSB_TRANSFER_TYPE_BULK:
-                std::cout << "Not implemented: OUT LIBUSB_TRANSFER_TYPE_BULK" << std::endl;
-                return LIBUSB_ERROR_NOT_SUPPORTED;
-            case LIBUSB_TRANSFER_TYPE_BULK_STREAM:
-                std::cout << "Not implemented: OUT LIBUSB_TRANSFER_TYPE_BULK_STREAM" << std::endl;
-                return LIBUSB_ERROR_NOT_SUPPORTED;
-            case LIBUSB_TRANSFER_TYPE_CONTROL:
-                std::cout << "Not implemented: OUT LIBUSB_TRANSFER_TYPE_CONTROL" << std::endl;
-                return LIBUSB_ERROR_NOT_SUPPORTED;
-            case LIBUSB_TRANSFER_TYPE_INTERRUPT:
-                std::cout << "Not implemented: OUT LIBUSB_TRANSFER_TYPE_INTERRUPT" << std::endl;
-                return LIBUSB_ERROR_NOT_SUPPORTED;
-            case LIBUSB_TRANSFER_TYPE_ISOCHRONOUS:
-                std::cout << "Not implemented: OUT LIBUSB_TRANSFER_TYPE_ISOCHRONOUS" << std::endl;
-                return LIBUSB_ERROR_NOT_SUPPORTED;
-        }
+        uint32_t seen = emscripten_atomic_cas_u32((void*)&ctx->delivery, state, state | DELIVERY_FREED);
+        if (seen == state)
+            return;
+        state = seen;
     }
-
-    return LIBUSB_ERROR_OTHER;
 }
 
-void _libusb_exit(libusb_context *ctx) {
-    // nothing to do
+void _libusb_webusb_get_pool_stats(struct libusb_webusb_pool_stats *stats) {
+    stats->hits = pool_hits;
+    stats->misses = pool_misses;
 }
 
-int LIBUSB_CALL _libusb_reset_device(libusb_device_handle *dev_handle) {
-    val device = val::global("device");
+int LIBUSB_CALL _libusb_clear_halt(libusb_device_handle *dev_handle, unsigned char endpoint) {
+    val device = settled_device(dev_handle);
 
     if (!device.as<bool>())
         return LIBUSB_ERROR_NO_DEVICE;
 
-    device.call<val>("reset").await();
+    std::string direction = ((endpoint & LIBUSB_ENDPOINT_DIR_MASK) & LIBUSB_ENDPOINT_OUT) ? "out" : "in";
+    unsigned char num = endpoint & ~LIBUSB_ENDPOINT_DIR_MASK;
 
-    return LIBUSB_SUCCESS;
-}
+    device.call<val>("clearHalt", direction, num).await();
 
-int LIBUSB_CALL _libusb_kernel_driver_active(libusb_device_handle *dev_handle, int interface_number) {
     return LIBUSB_SUCCESS;
 }
 
-int LIBUSB_CALL _libusb_cancel_transfer(struct libusb_transfer *transfer) {
-    transfer->status = LIBUSB_TRANSFER_CANCELLED;
-    return LIBUSB_SUCCESS;
+//
+// Asynchronous transfer completion.
+//
+// Submitting only starts the WebUSB promise. The handlers below are bound to
+// the transfer's submission id and run on the worker once the promise
+// settles, so any number of transfers can be outstanding on an endpoint at
+// the same time. A transfer that was cancelled or timed out has already left
+// the pending table, so its late result is dropped without touching the
+// buffer, which the application may have reused by then.
+//
+
+static thread_local uint32_t next_transfer_id = 0;
+static thread_local std::unordered_map<uint32_t, struct libusb_transfer*> pending;
+
+static struct libusb_transfer* pending_transfer(uint32_t id) {
+    auto it = pending.find(id);
+    return it == pending.end() ? nullptr : it->second;
 }
 
-void LIBUSB_CALL _libusb_free_transfer(struct libusb_transfer *transfer) {
-    free(transfer);
-}
+static void complete_transfer(struct libusb_transfer* transfer, enum libusb_transfer_status status) {
+    transfer->status = status;
 
-int LIBUSB_CALL _libusb_set_interface_alt_setting(libusb_device_handle *dev_handle,
-	int interface_number, int alternate_setting) {
-    val device = val::global("device");
+    pending.erase(tc(transfer)->id);
+    tc(transfer)->delivery = DELIVERY_QUEUED;
+    tc(transfer)->in_flight = false;
+    tc(transfer)->completed_at = emscripten_get_now();
 
-    if (!device.as<bool>())
-        return LIBUSB_ERROR_NO_DEVICE;
+    hc(transfer->dev_handle)->refs++;
 
-    device.call<val>("selectAlternateInterface", interface_number, alternate_setting).await();
+    webusb_context* ctx = hc(transfer->dev_handle)->ctx;
+    ctx->completions.push(transfer);
+    ctx->completions_pushed++;
+    signal_event(ctx);
+}
+
+static enum libusb_transfer_status transfer_status(val res) {
+    std::string status = res["status"].as<std::string>();
+
+    if (!status.compare("ok"))
+        return LIBUSB_TRANSFER_COMPLETED;
+    if (!status.compare("stall"))
+        return LIBUSB_TRANSFER_STALL;
+    if (!status.compare("babble"))
+        return LIBUSB_TRANSFER_OVERFLOW;
+
+    return LIBUSB_TRANSFER_ERROR;
+}
+
+void transfer_in_done(uint32_t id, val res) {
+    auto transfer = pending_transfer(id);
+    if (!transfer)
+        return;
+
+    transfer->actual_length = copy_in_data(res["data"], transfer->buffer, transfer->length);
+
+    complete_transfer(transfer, transfer_status(res));
+}
+
+void control_in_done(uint32_t id, val res) {
+    auto transfer = pending_transfer(id);
+    if (!transfer)
+        return;
+
+    transfer->actual_length = copy_in_data(res["data"], libusb_control_transfer_get_data(transfer),
+            transfer->length - LIBUSB_CONTROL_SETUP_SIZE);
+
+    complete_transfer(transfer, transfer_status(res));
+}
+
+void transfer_out_done(uint32_t id, val res) {
+    auto transfer = pending_transfer(id);
+    if (!transfer)
+        return;
+
+    transfer->actual_length = res["bytesWritten"].as<int>();
+
+    complete_transfer(transfer, transfer_status(res));
+}
+
+// Isochronous results carry no status of their own, only their packets do.
+// As in libusb, the transfer completes and errors are reported per packet.
+void iso_in_done(uint32_t id, val res) {
+    auto transfer = pending_transfer(id);
+    if (!transfer)
+        return;
+
+    // Packets sit at their requested offsets in res.data, which is the layout
+    // libusb expects, so one copy moves the whole transfer.
+    copy_in_data(res["data"], transfer->buffer, transfer->length);
+
+    val packets = res["packets"];
+    int total = 0;
+    for (int i = 0; i < transfer->num_iso_packets; i++) {
+        auto desc = &transfer->iso_packet_desc[i];
+        val packet = packets[i];
+        val data = packet["data"];
+
+        desc->actual_length = data.as<bool>() ? std::min(data["byteLength"].as<unsigned int>(), desc->length) : 0;
+        desc->status = transfer_status(packet);
+        total += desc->actual_length;
+    }
+    transfer->actual_length = total;
+
+    complete_transfer(transfer, LIBUSB_TRANSFER_COMPLETED);
+}
+
+void iso_out_done(uint32_t id, val res) {
+    auto transfer = pending_transfer(id);
+    if (!transfer)
+        return;
+
+    val packets = res["packets"];
+    int total = 0;
+    for (int i = 0; i < transfer->num_iso_packets; i++) {
+        auto desc = &transfer->iso_packet_desc[i];
+        val packet = packets[i];
+
+        desc->actual_length = packet["bytesWritten"].as<unsigned int>();
+        desc->status = transfer_status(packet);
+        total += desc->actual_length;
+    }
+    transfer->actual_length = total;
+
+    complete_transfer(transfer, LIBUSB_TRANSFER_COMPLETED);
+}
+
+static val iso_packet_lengths(struct libusb_transfer* transfer) {
+    val lengths = val::array();
+    for (int i = 0; i < transfer->num_iso_packets; i++)
+        lengths.set(i, transfer->iso_packet_desc[i].length);
+    return lengths;
+}
+
+static val out_promise(val device, struct libusb_transfer* transfer) {
+    if (transfer->type == LIBUSB_TRANSFER_TYPE_CONTROL) {
+        return device.call<val>("controlTransferOut", create_setup(transfer),
+                out_data(libusb_control_transfer_get_data(transfer), transfer->length - LIBUSB_CONTROL_SETUP_SIZE,
+                        &tc(transfer)->out_view));
+    }
+
+    unsigned char num = transfer->endpoint & ~LIBUSB_ENDPOINT_DIR_MASK;
+    val data = out_data(transfer->buffer, transfer->length, &tc(transfer)->out_view);
+
+    if (transfer->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS)
+        return device.call<val>("isochronousTransferOut", num, data, iso_packet_lengths(transfer));
+
+    return device.call<val>("transferOut", num, data);
+}
+
+static const char* out_done(struct libusb_transfer* transfer) {
+    if (transfer->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS)
+        return "_webusb_iso_out_done";
+
+    return "_webusb_transfer_out_done";
+}
+
+// Control transfers take their direction from the setup packet, everything
+// else from the endpoint address.
+static int transfer_direction(struct libusb_transfer* transfer) {
+    if (transfer->type == LIBUSB_TRANSFER_TYPE_CONTROL)
+        return libusb_control_transfer_get_setup(transfer)->bmRequestType & LIBUSB_ENDPOINT_DIR_MASK;
+
+    return transfer->endpoint & LIBUSB_ENDPOINT_DIR_MASK;
+}
+
+static void watch_transfer(struct libusb_transfer* transfer, val promise, const char* done);
+
+void transfer_failed(uint32_t id, val err) {
+    auto transfer = pending_transfer(id);
+    if (!transfer)
+        return;
+
+    // Every OUT transfer already in flight with a view is rejected as well,
+    // not only the first one, so each of them is retried.
+    if (transfer_direction(transfer) == LIBUSB_ENDPOINT_OUT && view_rejected(tc(transfer)->out_view, err)) {
+        device_slot* s = slot(transfer->dev_handle);
+        if (s) {
+            watch_transfer(transfer, out_promise(s->device, transfer), out_done(transfer));
+            return;
+        }
+    }
+
+    std::cout << "_submit_transfer: " << err["message"].as<std::string>() << std::endl;
+
+    transfer->actual_length = 0;
+    if (!err["name"].as<std::string>().compare("NotFoundError")) {
+        complete_transfer(transfer, LIBUSB_TRANSFER_NO_DEVICE);
+    } else {
+        complete_transfer(transfer, LIBUSB_TRANSFER_ERROR);
+    }
+}
+
+//
+// Interrupt IN polling.
+//
+// When an interrupt IN transfer completes, the next transferIn() on the
+// endpoint is started right away instead of waiting for the driver to
+// resubmit. The following submit on that endpoint picks up the armed promise
+// whatever its length, so the endpoint is polled continuously without
+// losing reports; a report longer than the new buffer completes it with
+// LIBUSB_TRANSFER_OVERFLOW.
+//
+
+static val interrupt_in_promise(device_slot* s, unsigned char endpoint, int length) {
+    auto it = s->interrupt_polls.find(endpoint);
+    if (it != s->interrupt_polls.end()) {
+        val promise = it->second;
+        s->interrupt_polls.erase(it);
+        return promise;
+    }
+
+    unsigned char num = endpoint & ~LIBUSB_ENDPOINT_DIR_MASK;
+    return s->device.call<val>("transferIn", num, length);
+}
+
+static void rearm_interrupt_in(libusb_device_handle* dev_handle, unsigned char endpoint, int length) {
+    device_slot* s = slot(dev_handle);
+
+    if (!s || s->interrupt_polls.count(endpoint))
+        return;
+
+    // Nobody may pick the poll up, e.g. after a disconnect, so its rejection
+    // is handled here. A later submit still sees it through the promise.
+    unsigned char num = endpoint & ~LIBUSB_ENDPOINT_DIR_MASK;
+    val promise = s->device.call<val>("transferIn", num, length);
+    promise.call<val>("catch", val::global("Function").new_());
+    s->interrupt_polls.insert(std::make_pair(endpoint, promise));
+}
+
+void interrupt_in_done(uint32_t id, val res) {
+    auto transfer = pending_transfer(id);
+    if (!transfer)
+        return;
+
+    val data = res["data"];
+    transfer->actual_length = copy_in_data(data, transfer->buffer, transfer->length);
+
+    enum libusb_transfer_status status = transfer_status(res);
+    if (status == LIBUSB_TRANSFER_COMPLETED && data.as<bool>() &&
+        data["byteLength"].as<int>() > transfer->length)
+        status = LIBUSB_TRANSFER_OVERFLOW;
+
+    // The transfer belongs to the application once it is completed.
+    libusb_device_handle* dev_handle = transfer->dev_handle;
+    unsigned char endpoint = transfer->endpoint;
+    int length = transfer->length;
+
+    complete_transfer(transfer, status);
+
+    if (status == LIBUSB_TRANSFER_COMPLETED)
+        rearm_interrupt_in(dev_handle, endpoint, length);
+}
+
+// Wait for promise for at most timeout ms, 0 waiting forever. Returns its
+// result, { error } if it rejected, or undefined if the time ran out. Only
+// for worker entry points, since it awaits.
+static val settle_within(val promise, unsigned int timeout) {
+    static thread_local val as_error = val::global("Function").new_(val("e"), val("return { error: e };"));
+    static thread_local val expire = val::global("Function").new_(val("ms"),
+            val("return new Promise(function(resolve) { setTimeout(resolve, ms); });"));
+
+    val settled = promise.call<val>("catch", as_error);
+    if (!timeout)
+        return settled.await();
+
+    val racers = val::array();
+    racers.call<void>("push", settled);
+    racers.call<void>("push", expire(timeout));
+    return val::global("Promise").call<val>("race", racers).await();
+}
+
+static int sync_result(val res, enum libusb_transfer_status status) {
+    if (!res.as<bool>())
+        return LIBUSB_ERROR_TIMEOUT;
+
+    if (res["error"].as<bool>()) {
+        std::cout << "_interrupt_transfer: " << res["error"]["message"].as<std::string>() << std::endl;
+        return res["error"]["name"].as<std::string>().compare("NotFoundError") ? LIBUSB_ERROR_IO : LIBUSB_ERROR_NO_DEVICE;
+    }
+
+    switch (status) {
+        case LIBUSB_TRANSFER_COMPLETED:
+            return LIBUSB_SUCCESS;
+        case LIBUSB_TRANSFER_STALL:
+            return LIBUSB_ERROR_PIPE;
+        case LIBUSB_TRANSFER_OVERFLOW:
+            return LIBUSB_ERROR_OVERFLOW;
+        default:
+            return LIBUSB_ERROR_IO;
+    }
+}
+
+// libusb_interrupt_transfer() in one call to the worker. WebUSB cannot abort
+// a transfer, so a timed out IN poll is kept armed for the next transfer on
+// the endpoint and its report is not lost.
+int LIBUSB_CALL _libusb_interrupt_transfer(libusb_device_handle *dev_handle,
+    unsigned char endpoint, unsigned char *data, int length,
+    int *transferred, unsigned int timeout) {
+    val device = settled_device(dev_handle);
+
+    if (!device.as<bool>())
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    device_slot* s = slot(dev_handle);
+    unsigned char num = endpoint & ~LIBUSB_ENDPOINT_DIR_MASK;
+    *transferred = 0;
+
+    if ((endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN) {
+        val promise = interrupt_in_promise(s, endpoint, length);
+        val res = settle_within(promise, timeout);
+
+        if (!res.as<bool>()) {
+            if (!s->interrupt_polls.count(endpoint))
+                s->interrupt_polls.insert(std::make_pair(endpoint, promise));
+            return LIBUSB_ERROR_TIMEOUT;
+        }
+        if (res["error"].as<bool>())
+            return sync_result(res, LIBUSB_TRANSFER_ERROR);
+
+        val in = res["data"];
+        *transferred = copy_in_data(in, data, length);
+
+        enum libusb_transfer_status status = transfer_status(res);
+        if (status == LIBUSB_TRANSFER_COMPLETED && in.as<bool>() && in["byteLength"].as<int>() > length)
+            status = LIBUSB_TRANSFER_OVERFLOW;
+        if (status == LIBUSB_TRANSFER_COMPLETED)
+            rearm_interrupt_in(dev_handle, endpoint, length);
+
+        return sync_result(res, status);
+    }
+
+    bool view;
+    val res = settle_within(device.call<val>("transferOut", num, out_data(data, length, &view)), timeout);
+    if (res.as<bool>() && res["error"].as<bool>() && view_rejected(view, res["error"]))
+        res = settle_within(device.call<val>("transferOut", num, out_data(data, length, &view)), timeout);
+
+    if (!res.as<bool>() || res["error"].as<bool>())
+        return sync_result(res, LIBUSB_TRANSFER_ERROR);
+
+    *transferred = res["bytesWritten"].as<int>();
+    return sync_result(res, transfer_status(res));
+}
+
+EMSCRIPTEN_BINDINGS(webusb_transfer) {
+    function("_webusb_transfer_in_done", &transfer_in_done);
+    function("_webusb_transfer_out_done", &transfer_out_done);
+    function("_webusb_control_in_done", &control_in_done);
+    function("_webusb_interrupt_in_done", &interrupt_in_done);
+    function("_webusb_iso_in_done", &iso_in_done);
+    function("_webusb_iso_out_done", &iso_out_done);
+    function("_webusb_transfer_failed", &transfer_failed);
+}
+
+//
+// Transfer timeouts.
+//
+// Deadlines live in a min-heap. A single emscripten timer is armed for the
+// earliest one; entries of transfers that completed in the meantime are
+// skipped when they reach the top.
+//
+
+typedef std::pair<double, uint32_t> transfer_deadline;
+
+static thread_local std::vector<transfer_deadline> deadlines;
+static thread_local int timer = 0;
+static thread_local double timer_deadline = 0;
+
+static void expire_transfers(void*);
+
+static void schedule_timeouts() {
+    while (!deadlines.empty() && !pending.count(deadlines.front().second)) {
+        std::pop_heap(deadlines.begin(), deadlines.end(), std::greater<transfer_deadline>());
+        deadlines.pop_back();
+    }
+
+    if (deadlines.empty())
+        return;
+
+    double next = deadlines.front().first;
+    if (timer && timer_deadline <= next)
+        return;
+
+    if (timer)
+        emscripten_clear_timeout(timer);
+
+    timer_deadline = next;
+    timer = emscripten_set_timeout(expire_transfers, std::max(0.0, next - emscripten_get_now()), nullptr);
+}
+
+static void expire_transfers(void*) {
+    timer = 0;
+
+    double now = emscripten_get_now();
+    while (!deadlines.empty() && deadlines.front().first <= now) {
+        uint32_t id = deadlines.front().second;
+        std::pop_heap(deadlines.begin(), deadlines.end(), std::greater<transfer_deadline>());
+        deadlines.pop_back();
+
+        // Read-ahead and split transfers may already hold part of their
+        // data, which was taken from the endpoint and is reported with the
+        // timeout, as libusb does.
+        auto transfer = pending_transfer(id);
+        if (transfer)
+            complete_transfer(transfer, LIBUSB_TRANSFER_TIMED_OUT);
+    }
+
+    schedule_timeouts();
+}
+
+static void watch_transfer(struct libusb_transfer* transfer, val promise, const char* done) {
+    uint32_t id = tc(transfer)->id;
+    promise.call<val>("then",
+        val::module_property(done).call<val>("bind", val::null(), id),
+        val::module_property("_webusb_transfer_failed").call<val>("bind", val::null(), id));
+}
+
+// Enter a transfer in the pending table and arm its timeout.
+static void track_transfer(struct libusb_transfer* transfer) {
+    tc(transfer)->in_flight = true;
+    tc(transfer)->id = ++next_transfer_id;
+    pending[tc(transfer)->id] = transfer;
+
+    if (transfer->timeout) {
+        deadlines.push_back(transfer_deadline(emscripten_get_now() + transfer->timeout, tc(transfer)->id));
+        std::push_heap(deadlines.begin(), deadlines.end(), std::greater<transfer_deadline>());
+        schedule_timeouts();
+    }
+}
+
+static void start_transfer(struct libusb_transfer* transfer, val promise, const char* done) {
+    track_transfer(transfer);
+    watch_transfer(transfer, promise, done);
+}
+
+//
+// Split transfers.
+//
+// A bulk IN transfer longer than the endpoint's split size is issued as
+// several packet-aligned transferIn() calls at once, so the browser keeps
+// more requests queued on the endpoint. The device answers the parts in the
+// order they were issued, so the endpoint keeps them in that order and its
+// split transfers consume them in submission order. A part that comes back
+// short ends the transfer reading it, as a short packet does. The parts
+// after it already hold the device's next transfers, so their data goes to
+// the next transfers on the endpoint rather than being merged in. With a
+// depth set, at most that many parts are in flight on the endpoint and the
+// rest wait their turn.
+//
+
+#define TUNE_WINDOW_MS      250.0
+#define TUNE_IDLE_MS        1000.0
+#define TUNE_MIN_COUNT      8
+#define TUNE_GAIN           1.05
+#define TUNE_DRIFT          0.25
+#define TUNE_START_SPLIT    (64 * 1024)
+#define TUNE_START_DEPTH    8
+#define TUNE_MAX_DEPTH      64
+#define TUNE_MAX_SPLIT      (1024 * 1024)
+
+static split_part* find_part(endpoint_state& ep, uint32_t seq) {
+    uint32_t index = seq - (ep.next_part - ep.parts.size());
+    return index < ep.parts.size() ? &ep.parts[index] : nullptr;
+}
+
+// Issue reserved parts while there is room. Parts of transfers that are no
+// longer pending are not needed by anyone and are skipped.
+static void issue_parts(device_slot* s, unsigned char endpoint) {
+    endpoint_state& ep = s->endpoints[endpoint];
+    unsigned char num = endpoint & ~LIBUSB_ENDPOINT_DIR_MASK;
+
+    while (ep.next_issue != ep.next_part && (!ep.depth || ep.parts_in_flight < ep.depth)) {
+        uint32_t seq = ep.next_issue++;
+        split_part* part = find_part(ep, seq);
+
+        if (!pending.count(part->id)) {
+            part->skipped = true;
+            part->done = true;
+            continue;
+        }
+
+        ep.parts_in_flight++;
+        part->issued_at = emscripten_get_now();
+
+        s->device.call<val>("transferIn", num, part->length).call<val>("then",
+            val::module_property("_webusb_split_in_done").call<val>("bind", val::null(), s->id, endpoint, seq),
+            val::module_property("_webusb_split_in_failed").call<val>("bind", val::null(), s->id, endpoint, seq));
+    }
+}
+
+static void reserve_part(endpoint_state& ep, uint32_t id, int length) {
+    split_part part;
+    part.id = id;
+    part.length = length;
+
+    ep.parts.push_back(part);
+    ep.next_part++;
+}
+
+// Hand the data of settled parts, in order, to the transfers waiting on the
+// endpoint. A part larger than what is left of a transfer carries over to
+// the next one, and so does the end of the device transfer it marks.
+static void serve_split(device_slot* s, unsigned char endpoint) {
+    endpoint_state& ep = s->endpoints[endpoint];
+
+    while (!ep.readers.empty()) {
+        auto transfer = pending_transfer(ep.readers.front());
+        if (!transfer) {
+            ep.readers.pop_front();
+            continue;
+        }
+
+        while (!ep.parts.empty() && ep.parts.front().skipped)
+            ep.parts.pop_front();
+
+        if (ep.parts.empty() || !ep.parts.front().done)
+            return;
+
+        split_part& part = ep.parts.front();
+        int len = std::min(part.received - part.pos, transfer->length - transfer->actual_length);
+        if (len) {
+            val data = part.data;
+            val src = val::global("Uint8Array").new_(data["buffer"], data["byteOffset"].as<int>() + part.pos, len);
+            copy_in_data(src, transfer->buffer + transfer->actual_length, len);
+            part.pos += len;
+            transfer->actual_length += len;
+        }
+
+        bool drained = part.pos == part.received;
+        bool ended = drained && (part.status != LIBUSB_TRANSFER_COMPLETED || part.received < part.length);
+        enum libusb_transfer_status status = part.status;
+
+        if (drained)
+            ep.parts.pop_front();
+
+        if (ended || transfer->actual_length == transfer->length) {
+            ep.readers.pop_front();
+            complete_transfer(transfer, ended ? status : LIBUSB_TRANSFER_COMPLETED);
+        }
+    }
+}
+
+// Move the operating point one step along the current dimension and
+// direction. Returns false if that runs into a bound.
+static bool tune_step(endpoint_state& ep) {
+    if (ep.tune_dim == 0) {
+        int packet = packet_size(ep);
+        int max = std::max(packet, std::min(TUNE_MAX_SPLIT, ep.max_length) / packet * packet);
+        int size = ep.tune_dir > 0 ? ep.split_size * 2 : ep.split_size / 2;
+        size = std::min(std::max(size / packet * packet, packet), max);
+        if (size == ep.split_size)
+            return false;
+        ep.split_size = size;
+    } else {
+        int depth = ep.tune_dir > 0 ? ep.depth * 2 : ep.depth / 2;
+        depth = std::min(std::max(depth, 1), TUNE_MAX_DEPTH);
+        if (depth == ep.depth)
+            return false;
+        ep.depth = depth;
+    }
+
+    return true;
+}
+
+// After a step that did not pay off, try the other direction, then the other
+// dimension. Four failures in a row mean no neighbour is better.
+static void tune_next(endpoint_state& ep) {
+    if (++ep.tune_failures % 2) {
+        ep.tune_dir = -ep.tune_dir;
+    } else {
+        ep.tune_dim ^= 1;
+        ep.tune_dir = 1;
+    }
+}
+
+static void tune_probe(endpoint_state& ep) {
+    ep.prev_split_size = ep.split_size;
+    ep.prev_depth = ep.depth;
+
+    while (ep.tune_failures < 4) {
+        if (tune_step(ep)) {
+            ep.probing = true;
+            return;
+        }
+        tune_next(ep);
+    }
+
+    ep.settled = true;
+}
+
+// Hill-climb on split size and depth, one measurement window per step. A
+// step is kept if it raised throughput by more than TUNE_GAIN, otherwise it
+// is undone. Once settled, the tuner only starts probing again if throughput
+// drifts away from what it settled on.
+static void tune_endpoint(endpoint_state& ep, double throughput) {
+    if (ep.probing) {
+        ep.probing = false;
+        if (throughput > ep.best * TUNE_GAIN) {
+            ep.best = throughput;
+            ep.tune_failures = 0;
+        } else {
+            ep.split_size = ep.prev_split_size;
+            ep.depth = ep.prev_depth;
+            tune_next(ep);
+        }
+    } else if (ep.settled) {
+        if (std::abs(throughput - ep.best) <= ep.best * TUNE_DRIFT)
+            return;
+        ep.settled = false;
+        ep.tune_failures = 0;
+        ep.best = throughput;
+    } else {
+        ep.best = throughput;
+    }
+
+    tune_probe(ep);
+}
+
+// Account a completed part to the endpoint's measurement window.
+static void measure_part(endpoint_state& ep, double issued, int length) {
+    double now = emscripten_get_now();
+
+    if (!ep.window_start)
+        ep.window_start = issued;
+
+    ep.window_bytes += length;
+    ep.window_latency += now - issued;
+    ep.window_count++;
+
+    double elapsed = now - ep.window_start;
+    if (elapsed < TUNE_WINDOW_MS)
+        return;
+
+    if (ep.window_count >= TUNE_MIN_COUNT) {
+        double throughput = ep.window_bytes * 1000.0 / elapsed;
+        ep.throughput = throughput;
+        ep.latency_us = ep.window_latency * 1000.0 / ep.window_count;
+        if (ep.autotune)
+            tune_endpoint(ep, throughput);
+    } else if (elapsed < TUNE_IDLE_MS) {
+        return;
+    }
+
+    ep.window_start = now;
+    ep.window_latency = 0;
+    ep.window_bytes = 0;
+    ep.window_count = 0;
+}
+
+// A part settled: record its result, issue the next waiting part and serve
+// the transfers waiting on the endpoint.
+static void part_settled(int handle, unsigned char endpoint, uint32_t seq,
+        enum libusb_transfer_status status, val data) {
+    device_slot* s = slot(handle);
+    if (!s)
+        return;
+
+    auto it = s->endpoints.find(endpoint);
+    if (it == s->endpoints.end())
+        return;
+
+    endpoint_state& ep = it->second;
+    ep.parts_in_flight--;
+
+    split_part* part = find_part(ep, seq);
+    if (part) {
+        part->done = true;
+        part->status = status;
+        part->data = data;
+        part->received = data.as<bool>() ? std::min(data["byteLength"].as<int>(), part->length) : 0;
+        measure_part(ep, part->issued_at, part->received);
+    }
+
+    issue_parts(s, endpoint);
+    serve_split(s, endpoint);
+}
+
+void split_in_done(int handle, unsigned int endpoint, uint32_t seq, val res) {
+    part_settled(handle, endpoint, seq, transfer_status(res), res["data"]);
+}
+
+void split_in_failed(int handle, unsigned int endpoint, uint32_t seq, val err) {
+    std::cout << "_submit_transfer: " << err["message"].as<std::string>() << std::endl;
+
+    if (!err["name"].as<std::string>().compare("NotFoundError")) {
+        part_settled(handle, endpoint, seq, LIBUSB_TRANSFER_NO_DEVICE, val::null());
+    } else {
+        part_settled(handle, endpoint, seq, LIBUSB_TRANSFER_ERROR, val::null());
+    }
+}
+
+// Returns false if the transfer goes out in one piece. With auto-tuning on,
+// every bulk IN transfer on the endpoint is split so the depth limit applies.
+// While parts are left over from earlier transfers, their data comes first,
+// so every transfer queues behind them whatever its length.
+static bool split_transfer(device_slot* s, struct libusb_transfer* transfer) {
+    endpoint_state& ep = s->endpoints[transfer->endpoint];
+    int packet = packet_size(ep);
+    int part_size = ep.split_size / packet * packet;
+
+    ep.max_length = std::max(ep.max_length, transfer->length);
+
+    if (ep.parts.empty() && (!part_size || (transfer->length <= part_size && !ep.autotune)))
+        return false;
+
+    if (!part_size)
+        part_size = std::max(transfer->length, 1);
+
+    track_transfer(transfer);
+
+    uint32_t id = tc(transfer)->id;
+    ep.readers.push_back(id);
+
+    int parts = std::max(1, (transfer->length + part_size - 1) / part_size);
+    for (int part = 0; part < parts; part++)
+        reserve_part(ep, id, std::min(part_size, transfer->length - part * part_size));
+
+    issue_parts(s, transfer->endpoint);
+    serve_split(s, transfer->endpoint);
+
+    return true;
+}
+
+int LIBUSB_CALL _libusb_webusb_set_split_size(libusb_device_handle *dev_handle, unsigned char endpoint, int split_size) {
+    if (!(endpoint & LIBUSB_ENDPOINT_IN) || split_size < 0)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    device_slot* s = slot(dev_handle);
+    if (!s)
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    s->endpoints[endpoint].split_size = split_size;
+
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL _libusb_webusb_set_autotune(libusb_device_handle *dev_handle, unsigned char endpoint, int enable) {
+    if (!(endpoint & LIBUSB_ENDPOINT_IN))
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    device_slot* s = slot(dev_handle);
+    if (!s)
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    endpoint_state& ep = s->endpoints[endpoint];
+    ep.autotune = enable;
+    ep.probing = false;
+    ep.settled = false;
+    ep.tune_dim = 0;
+    ep.tune_dir = 1;
+    ep.tune_failures = 0;
+
+    if (enable) {
+        int packet = packet_size(ep);
+        int split_size = ep.split_size ? ep.split_size : TUNE_START_SPLIT;
+        ep.split_size = std::max(packet, split_size / packet * packet);
+        ep.depth = TUNE_START_DEPTH;
+    } else {
+        ep.depth = 0;
+    }
+
+    ep.window_start = emscripten_get_now();
+    ep.window_latency = 0;
+    ep.window_bytes = 0;
+    ep.window_count = 0;
+
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL _libusb_webusb_get_tuning(libusb_device_handle *dev_handle, unsigned char endpoint,
+    struct libusb_webusb_tuning *tuning) {
+    if (!(endpoint & LIBUSB_ENDPOINT_IN))
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    device_slot* s = slot(dev_handle);
+    if (!s)
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    endpoint_state& ep = s->endpoints[endpoint];
+    tuning->split_size = ep.split_size;
+    tuning->depth = ep.depth;
+    tuning->throughput = ep.throughput;
+    tuning->latency_us = ep.latency_us;
+    tuning->settled = ep.settled;
+
+    return LIBUSB_SUCCESS;
+}
+
+//
+// Read-ahead.
+//
+// With read-ahead enabled on an endpoint, libusb_bulk_transfer() reads are
+// queued on the endpoint and served in order from a buffer that is refilled
+// with one large transferIn() whenever it runs dry, so a run of small reads
+// costs a single WebUSB round trip. A read only returns short where the
+// device actually ended a transfer. Asynchronous transfers bypass the buffer,
+// so the endpoint must not be read both ways at once.
+//
+
+static void serve_read_ahead(device_slot* s, unsigned char endpoint);
+
+static void fail_read_ahead(device_slot* s, unsigned char endpoint, enum libusb_transfer_status status) {
+    endpoint_state& ep = s->endpoints[endpoint];
+
+    while (!ep.waiters.empty()) {
+        auto transfer = pending_transfer(ep.waiters.front());
+        ep.waiters.pop_front();
+        if (transfer) {
+            complete_transfer(transfer, status);
+            break;
+        }
+    }
+
+    serve_read_ahead(s, endpoint);
+}
+
+void read_ahead_done(int handle, unsigned int endpoint, int size, val res) {
+    device_slot* s = slot(handle);
+    if (!s)
+        return;
+
+    auto it = s->endpoints.find(endpoint);
+    if (it == s->endpoints.end())
+        return;
+
+    endpoint_state& ep = it->second;
+    ep.reading = false;
+
+    enum libusb_transfer_status status = transfer_status(res);
+    if (status != LIBUSB_TRANSFER_COMPLETED) {
+        fail_read_ahead(s, endpoint, status);
+        return;
+    }
+
+    ep.ahead.resize(size);
+    ep.ahead.resize(copy_in_data(res["data"], ep.ahead.data(), size));
+    ep.ahead_pos = 0;
+    ep.ahead_short = (int)ep.ahead.size() < size;
+
+    serve_read_ahead(s, endpoint);
+}
+
+void read_ahead_failed(int handle, unsigned int endpoint, val err) {
+    device_slot* s = slot(handle);
+    if (!s)
+        return;
+
+    auto it = s->endpoints.find(endpoint);
+    if (it == s->endpoints.end())
+        return;
+
+    std::cout << "_submit_transfer: " << err["message"].as<std::string>() << std::endl;
+
+    it->second.reading = false;
+    if (!err["name"].as<std::string>().compare("NotFoundError")) {
+        fail_read_ahead(s, endpoint, LIBUSB_TRANSFER_NO_DEVICE);
+    } else {
+        fail_read_ahead(s, endpoint, LIBUSB_TRANSFER_ERROR);
+    }
+}
+
+static void start_read_ahead(device_slot* s, unsigned char endpoint, int length) {
+    endpoint_state& ep = s->endpoints[endpoint];
+    int size = align_up(std::max(ep.read_ahead, length), packet_size(ep));
+    unsigned char num = endpoint & ~LIBUSB_ENDPOINT_DIR_MASK;
+
+    ep.reading = true;
+    s->device.call<val>("transferIn", num, size).call<val>("then",
+        val::module_property("_webusb_read_ahead_done").call<val>("bind", val::null(), s->id, endpoint, size),
+        val::module_property("_webusb_read_ahead_failed").call<val>("bind", val::null(), s->id, endpoint));
+}
+
+static void serve_read_ahead(device_slot* s, unsigned char endpoint) {
+    endpoint_state& ep = s->endpoints[endpoint];
+
+    while (!ep.waiters.empty()) {
+        auto transfer = pending_transfer(ep.waiters.front());
+        if (!transfer) {
+            ep.waiters.pop_front();
+            continue;
+        }
+
+        int len = std::min((int)(ep.ahead.size() - ep.ahead_pos), transfer->length - transfer->actual_length);
+        memcpy(transfer->buffer + transfer->actual_length, ep.ahead.data() + ep.ahead_pos, len);
+        ep.ahead_pos += len;
+        transfer->actual_length += len;
+
+        // The device ended a transfer where the buffered data runs out.
+        bool ended = ep.ahead_short && ep.ahead_pos == ep.ahead.size();
+
+        if (transfer->actual_length < transfer->length && !ended) {
+            if (!ep.reading)
+                start_read_ahead(s, endpoint, transfer->length - transfer->actual_length);
+            return;
+        }
+
+        if (ended)
+            ep.ahead_short = false;
+
+        ep.waiters.pop_front();
+        complete_transfer(transfer, LIBUSB_TRANSFER_COMPLETED);
+    }
+}
+
+// Returns false if read-ahead is off for the transfer's endpoint.
+static bool read_ahead(device_slot* s, struct libusb_transfer* transfer) {
+    auto it = s->endpoints.find(transfer->endpoint);
+    if (it == s->endpoints.end() || !it->second.read_ahead)
+        return false;
+
+    track_transfer(transfer);
+    it->second.waiters.push_back(tc(transfer)->id);
+    serve_read_ahead(s, transfer->endpoint);
+
+    return true;
+}
+
+int LIBUSB_CALL _libusb_webusb_set_read_ahead(libusb_device_handle *dev_handle, unsigned char endpoint, int size) {
+    if (!(endpoint & LIBUSB_ENDPOINT_IN) || size < 0)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    device_slot* s = slot(dev_handle);
+    if (!s)
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    endpoint_state& ep = s->endpoints[endpoint];
+    ep.read_ahead = size;
+    if (!size) {
+        ep.ahead.clear();
+        ep.ahead_pos = 0;
+        ep.ahead_short = false;
+    }
+
+    return LIBUSB_SUCCESS;
+}
+
+//
+// Streams.
+//
+// A stream owns its WebUSB transfers. Each completion is copied into the
+// stream's ring and the transfer is issued again right away, without going
+// through a libusb_transfer or a callback. The ring is single-producer,
+// single-consumer: only the worker moves head and only the consumer moves
+// tail, so a full ring drops new data instead of overwriting unread data.
+//
+
+static thread_local uint32_t next_stream_id = 0;
+static thread_local std::unordered_map<uint32_t, struct libusb_webusb_stream*> streams;
+
+static void stream_failed(struct libusb_webusb_stream* stream, int error);
+
+static void stream_issue(struct libusb_webusb_stream* stream) {
+    device_slot* s = slot(stream->dev_handle);
+    unsigned char num = stream->endpoint & ~LIBUSB_ENDPOINT_DIR_MASK;
+
+    if (!s) {
+        stream_failed(stream, LIBUSB_ERROR_NO_DEVICE);
+        return;
+    }
+
+    stream->in_flight++;
+    s->device.call<val>("transferIn", num, stream->transfer_size).call<val>("then",
+        val::module_property("_webusb_stream_in_done").call<val>("bind", val::null(), stream->id),
+        val::module_property("_webusb_stream_in_failed").call<val>("bind", val::null(), stream->id));
+}
+
+// Account a settled transfer. Returns false if the stream is gone or
+// stopping, in which case the transfer must not be issued again.
+static bool stream_settled(struct libusb_webusb_stream* stream) {
+    stream->in_flight--;
+
+    if (!stream->stopping && !stream->error)
+        return true;
+
+    if (stream->stopping && !stream->in_flight) {
+        streams.erase(stream->id);
+        delete stream;
+    }
+
+    return false;
+}
+
+static void stream_write(struct libusb_webusb_stream* stream, val data) {
+    if (!data.as<bool>())
+        return;
+
+    uint32_t len = data["byteLength"].as<uint32_t>();
+    uint32_t head = stream->head;
+    uint32_t space = stream->size - (head - stream->tail);
+
+    stream->bytes += len;
+    if (len > space) {
+        stream->overruns++;
+        stream->dropped += len - space;
+        len = space;
+    }
+    if (!len)
+        return;
+
+    val src = val::global("Uint8Array").new_(data["buffer"], data["byteOffset"], len);
+    uint32_t pos = head & (stream->size - 1);
+    uint32_t first = std::min(len, stream->size - pos);
+
+    copy_in_data(src.call<val>("subarray", 0, first), stream->ring + pos, first);
+    if (first < len)
+        copy_in_data(src.call<val>("subarray", first, len), stream->ring, len - first);
+
+    stream->head = head + len;
+    emscripten_futex_wake(&stream->head, INT_MAX);
+}
+
+static void stream_failed(struct libusb_webusb_stream* stream, int error) {
+    if (!stream->error)
+        stream->error = error;
+
+    // Wake a reader blocked on an empty ring.
+    emscripten_futex_wake(&stream->head, INT_MAX);
+}
+
+void stream_in_done(uint32_t id, val res) {
+    auto it = streams.find(id);
+    if (it == streams.end())
+        return;
+
+    auto stream = it->second;
+    if (!stream_settled(stream))
+        return;
+
+    stream_write(stream, res["data"]);
+
+    switch (transfer_status(res)) {
+        case LIBUSB_TRANSFER_COMPLETED:
+            stream_issue(stream);
+            break;
+        case LIBUSB_TRANSFER_STALL:
+            stream_failed(stream, LIBUSB_ERROR_PIPE);
+            break;
+        case LIBUSB_TRANSFER_OVERFLOW:
+            stream_failed(stream, LIBUSB_ERROR_OVERFLOW);
+            break;
+        default:
+            stream_failed(stream, LIBUSB_ERROR_IO);
+            break;
+    }
+}
+
+void stream_in_failed(uint32_t id, val err) {
+    auto it = streams.find(id);
+    if (it == streams.end())
+        return;
+
+    auto stream = it->second;
+    if (!stream_settled(stream))
+        return;
+
+    std::cout << "_webusb_stream: " << err["message"].as<std::string>() << std::endl;
+
+    if (!err["name"].as<std::string>().compare("NotFoundError")) {
+        stream_failed(stream, LIBUSB_ERROR_NO_DEVICE);
+    } else {
+        stream_failed(stream, LIBUSB_ERROR_IO);
+    }
+}
+
+int LIBUSB_CALL _libusb_webusb_stream_start(libusb_device_handle *dev_handle, unsigned char endpoint,
+    unsigned char *ring, size_t ring_size, int transfer_size, int transfers,
+    struct libusb_webusb_stream **stream) {
+    val device = settled_device(dev_handle);
+
+    if (!device.as<bool>())
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    if (!(endpoint & LIBUSB_ENDPOINT_IN) || !ring || !ring_size || (ring_size & (ring_size - 1)) ||
+        ring_size > (1U << 31) || transfer_size <= 0 || transfers <= 0)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    auto s = new libusb_webusb_stream();
+    s->dev_handle = dev_handle;
+    s->id = ++next_stream_id;
+    s->endpoint = endpoint;
+    s->ring = ring;
+    s->size = ring_size;
+    s->transfer_size = transfer_size;
+    streams[s->id] = s;
+
+    for (int i = 0; i < transfers; i++)
+        stream_issue(s);
+
+    *stream = s;
+
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL _libusb_webusb_stream_stop(struct libusb_webusb_stream *stream) {
+    if (!streams.count(stream->id))
+        return LIBUSB_ERROR_NOT_FOUND;
+
+    stream->stopping = true;
+    stream_failed(stream, LIBUSB_ERROR_INTERRUPTED);
+
+    if (!stream->in_flight) {
+        streams.erase(stream->id);
+        delete stream;
+    }
+
+    return LIBUSB_SUCCESS;
+}
+
+EMSCRIPTEN_BINDINGS(webusb_stream) {
+    function("_webusb_stream_in_done", &stream_in_done);
+    function("_webusb_stream_in_failed", &stream_in_failed);
+}
+
+EMSCRIPTEN_BINDINGS(webusb_split) {
+    function("_webusb_split_in_done", &split_in_done);
+    function("_webusb_split_in_failed", &split_in_failed);
+    function("_webusb_read_ahead_done", &read_ahead_done);
+    function("_webusb_read_ahead_failed", &read_ahead_failed);
+}
+
+static int submit_transfer(device_slot* s, struct libusb_transfer *transfer) {
+    val device = s->device;
+
+    transfer->status = LIBUSB_TRANSFER_COMPLETED;
+    transfer->actual_length = 0;
+
+    if (transfer->type == LIBUSB_TRANSFER_TYPE_CONTROL) {
+        if (transfer->length < (int)LIBUSB_CONTROL_SETUP_SIZE)
+            return LIBUSB_ERROR_INVALID_PARAM;
+
+        val setup = create_setup(transfer);
+        if (setup.isNull())
+            return LIBUSB_ERROR_INVALID_PARAM;
+
+        if (transfer_direction(transfer) == LIBUSB_ENDPOINT_IN) {
+            uint16_t wLength = libusb_le16_to_cpu(libusb_control_transfer_get_setup(transfer)->wLength);
+            start_transfer(transfer, device.call<val>("controlTransferIn", setup, wLength),
+                    "_webusb_control_in_done");
+        } else {
+            start_transfer(transfer, out_promise(device, transfer), out_done(transfer));
+        }
+
+        return LIBUSB_SUCCESS;
+    }
+
+    unsigned char num = transfer->endpoint & ~LIBUSB_ENDPOINT_DIR_MASK;
+    if ((transfer->endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN) {
+        switch(transfer->type) {
+            case LIBUSB_TRANSFER_TYPE_BULK:
+                if (tc(transfer)->sync && read_ahead(s, transfer))
+                    return LIBUSB_SUCCESS;
+                if (split_transfer(s, transfer))
+                    return LIBUSB_SUCCESS;
+                start_transfer(transfer, device.call<val>("transferIn", num, transfer->length),
+                        "_webusb_transfer_in_done");
+                return LIBUSB_SUCCESS;
+            case LIBUSB_TRANSFER_TYPE_BULK_STREAM:
+                std::cout << "Not implemented: IN LIBUSB_TRANSFER_TYPE_BULK_STREAM" << std::endl;
+                return LIBUSB_ERROR_NOT_SUPPORTED;
+            case LIBUSB_TRANSFER_TYPE_INTERRUPT:
+                start_transfer(transfer, interrupt_in_promise(s, transfer->endpoint, transfer->length),
+                        "_webusb_interrupt_in_done");
+                return LIBUSB_SUCCESS;
+            case LIBUSB_TRANSFER_TYPE_ISOCHRONOUS:
+                start_transfer(transfer, device.call<val>("isochronousTransferIn", num,
+                            iso_packet_lengths(transfer)), "_webusb_iso_in_done");
+                return LIBUSB_SUCCESS;
+        }
+    }
+
+    if ((transfer->endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_OUT) {
+        switch(transfer->type) {
+            case LIBUSB_TRANSFER_TYPE_BULK:
+            case LIBUSB_TRANSFER_TYPE_INTERRUPT:
+            case LIBUSB_TRANSFER_TYPE_ISOCHRONOUS:
+                start_transfer(transfer, out_promise(device, transfer), out_done(transfer));
+                return LIBUSB_SUCCESS;
+            case LIBUSB_TRANSFER_TYPE_BULK_STREAM:
+                std::cout << "Not implemented: OUT LIBUSB_TRANSFER_TYPE_BULK_STREAM" << std::endl;
+                return LIBUSB_ERROR_NOT_SUPPORTED;
+        }
+    }
+
+    return LIBUSB_ERROR_OTHER;
+}
+
+int LIBUSB_CALL _libusb_submit_transfer(struct libusb_transfer *transfer) {
+    device_slot* s = slot(transfer->dev_handle);
+
+    if (!s) {
+        std::cout << "_submit_transfer: no device" << std::endl;
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+
+    settle_device_ops(s);
+
+    if (tc(transfer)->in_flight)
+        return LIBUSB_ERROR_BUSY;
+
+    // Workers of different devices submit concurrently, so reserve the
+    // completion slot before checking the cap.
+    webusb_context* ctx = hc(transfer->dev_handle)->ctx;
+    if (ctx->outstanding++ >= (int)ctx->completions.capacity()) {
+        ctx->outstanding--;
+        return LIBUSB_ERROR_NO_MEM;
+    }
+
+    int r = submit_transfer(s, transfer);
+    if (r != LIBUSB_SUCCESS)
+        ctx->outstanding--;
+
+    return r;
+}
+
+int LIBUSB_CALL _libusb_webusb_submit_transfers(struct libusb_transfer **transfers, int count) {
+    for (int i = 0; i < count; i++) {
+        int r = _libusb_submit_transfer(transfers[i]);
+        if (r != LIBUSB_SUCCESS)
+            return i ? i : r;
+    }
+
+    return count;
+}
+
+// Settle the promises of one pipelined run of a control batch and store each
+// request's result. Returns false if any of them failed.
+static bool finish_control_run(val promises, struct libusb_webusb_control_request *requests, int first) {
+    val results = val::global("Promise").call<val>("allSettled", promises).await();
+    bool ok = true;
+
+    for (int i = 0; i < results["length"].as<int>(); i++) {
+        struct libusb_webusb_control_request *req = &requests[first + i];
+        val result = results[i];
+
+        if (result["status"].as<std::string>().compare("fulfilled")) {
+            req->result = LIBUSB_ERROR_IO;
+        } else {
+            val res = result["value"];
+            if (transfer_status(res) != LIBUSB_TRANSFER_COMPLETED) {
+                req->result = LIBUSB_ERROR_IO;
+            } else if ((req->bmRequestType & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN) {
+                req->result = copy_in_data(res["data"], req->data, req->wLength);
+            } else {
+                req->result = res["bytesWritten"].as<int>();
+            }
+        }
+
+        if (req->result < 0)
+            ok = false;
+    }
+
+    return ok;
+}
+
+int LIBUSB_CALL _libusb_webusb_control_batch(libusb_device_handle *dev_handle,
+    struct libusb_webusb_control_request *requests, int count) {
+    val device = settled_device(dev_handle);
+
+    if (!device.as<bool>())
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    for (int i = 0; i < count; i++) {
+        if ((requests[i].bmRequestType & 0x60) == LIBUSB_REQUEST_TYPE_RESERVED)
+            return LIBUSB_ERROR_INVALID_PARAM;
+    }
+
+    bool ok = true;
+    int first = 0;
+    val promises = val::array();
+
+    for (int i = 0; i < count; i++) {
+        struct libusb_webusb_control_request *req = &requests[i];
+
+        if ((req->flags & LIBUSB_WEBUSB_CONTROL_BARRIER) && i > first) {
+            ok = finish_control_run(promises, requests, first) && ok;
+            promises = val::array();
+            first = i;
+        }
+
+        if (!ok && (req->flags & LIBUSB_WEBUSB_CONTROL_BARRIER)) {
+            for (; i < count; i++)
+                requests[i].result = LIBUSB_ERROR_INTERRUPTED;
+            break;
+        }
+
+        val setup = create_setup(req->bmRequestType, req->bRequest, req->wValue, req->wIndex);
+
+        if ((req->bmRequestType & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN) {
+            promises.call<void>("push", device.call<val>("controlTransferIn", setup, req->wLength));
+        } else {
+            promises.call<void>("push", device.call<val>("controlTransferOut", setup,
+                        create_out_buffer(req->data, req->wLength)));
+        }
+    }
+
+    if (promises["length"].as<int>())
+        finish_control_run(promises, requests, first);
+
+    for (int i = 0; i < count; i++) {
+        if (requests[i].result < 0)
+            return requests[i].result;
+    }
+
+    return LIBUSB_SUCCESS;
+}
+
+// Complete the handle's transfers as cancelled and fail its streams, before
+// the handle leaves the table.
+static void cancel_handle_transfers(libusb_device_handle *dev_handle) {
+    std::vector<struct libusb_transfer*> cancelled;
+    for (auto& entry : pending) {
+        if (entry.second->dev_handle == dev_handle)
+            cancelled.push_back(entry.second);
+    }
+
+    for (auto transfer : cancelled) {
+        transfer->actual_length = 0;
+        complete_transfer(transfer, LIBUSB_TRANSFER_CANCELLED);
+    }
+
+    for (auto& entry : streams) {
+        if (entry.second->dev_handle == dev_handle)
+            stream_failed(entry.second, LIBUSB_ERROR_NO_DEVICE);
+    }
+}
+
+// Tear down everything the worker holds before it exits. Transfers still in
+// flight are dropped without a callback, since nobody will handle events for
+// the context any more.
+void _libusb_exit(libusb_context *ctx) {
+    webusb_context* context = (webusb_context*)ctx;
+
+    for (auto& entry : pending)
+        tc(entry.second)->in_flight = false;
+    pending.clear();
+
+    // Completions nobody will deliver. Freed transfers were left to the
+    // consumer, the others still belong to the application.
+    if (pthread_equal(pthread_self(), context->worker)) {
+        struct libusb_transfer* transfer;
+        while (context->completions.pop(transfer)) {
+            if (emscripten_atomic_cas_u32((void*)&tc(transfer)->delivery, DELIVERY_QUEUED, DELIVERY_NONE) !=
+                DELIVERY_QUEUED)
+                release_transfer(transfer);
+        }
+    }
+
+    deadlines.clear();
+    if (timer)
+        emscripten_clear_timeout(timer);
+    timer = 0;
+
+    for (auto& entry : streams) {
+        stream_failed(entry.second, LIBUSB_ERROR_INTERRUPTED);
+        delete entry.second;
+    }
+    streams.clear();
+
+    for (auto& entry : handles) {
+        device_slot* s = &entry.second;
+        queue_device_op(s, s->device["close"].call<val>("bind", s->device));
+        closing.push_back(s->ops);
+    }
+    handles.clear();
+
+    settle_closing();
+    worker_devices = val::undefined();
+}
+
+int LIBUSB_CALL _libusb_reset_device(libusb_device_handle *dev_handle) {
+    val device = settled_device(dev_handle);
+
+    if (!device.as<bool>())
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    device.call<val>("reset").await();
+
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL _libusb_kernel_driver_active(libusb_device_handle *dev_handle, int interface_number) {
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL _libusb_cancel_transfer(struct libusb_transfer *transfer) {
+    if (!tc(transfer)->in_flight)
+        return LIBUSB_ERROR_NOT_FOUND;
+
+    // WebUSB cannot abort a pending transfer. Completing it here removes it
+    // from the pending table, so whatever the device returns later is dropped.
+    transfer->actual_length = 0;
+    complete_transfer(transfer, LIBUSB_TRANSFER_CANCELLED);
+
+    return LIBUSB_SUCCESS;
+}
+
+void LIBUSB_CALL _libusb_free_transfer(struct libusb_transfer *transfer) {
+    if (!transfer)
+        return;
+
+    if (tc(transfer)->in_flight) {
+        pending.erase(tc(transfer)->id);
+        hc(transfer->dev_handle)->ctx->outstanding--;
+    }
+
+    // Cancelled, completed or freed from its own callback, handle_events
+    // still looks at it.
+    release_when_delivered(transfer);
+}
+
+int LIBUSB_CALL _libusb_set_interface_alt_setting(libusb_device_handle *dev_handle,
+	int interface_number, int alternate_setting) {
+    val device = settled_device(dev_handle);
+
+    if (!device.as<bool>())
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    device.call<val>("selectAlternateInterface", interface_number, alternate_setting).await();
 
     return LIBUSB_SUCCESS;
 }
@@ -407,25 +2461,185 @@ int LIBUSB_CALL _libusb_handle_events_timeout(libusb_context *ctx, struct timeva
     return libusb_handle_events_timeout_completed(ctx, tv, nullptr);
 }
 
+// Re-arm an auto-resubmit transfer right after its callback. This goes
+// through the public call, since the transfer's device may have a worker of
+// its own. A failure is reported through the callback like any other
+// completion.
+static void auto_resubmit(struct libusb_transfer* transfer) {
+    int r = webusb_resubmit_transfer(transfer);
+    if (r == LIBUSB_SUCCESS)
+        return;
+
+    hc(transfer->dev_handle)->ctx->outstanding++;
+    transfer->actual_length = 0;
+    complete_transfer(transfer, r == LIBUSB_ERROR_NO_DEVICE ? LIBUSB_TRANSFER_NO_DEVICE : LIBUSB_TRANSFER_ERROR);
+}
+
+// Account a delivered transfer and the time its callback took to the
+// context's callback stats. Times are in milliseconds.
+static void count_callback(webusb_context* ctx, double latency, double duration, bool on_worker) {
+    uint32_t latency_us = latency * 1000.0;
+    uint32_t duration_us = duration * 1000.0;
+
+    ctx->callback_stats.callbacks++;
+    ctx->callback_stats.latency_us += latency_us;
+    if (latency_us > ctx->callback_stats.max_latency_us)
+        ctx->callback_stats.max_latency_us = latency_us;
+    ctx->callback_stats.callback_us += duration_us;
+    if (on_worker)
+        ctx->callback_stats.worker_callback_us += duration_us;
+}
+
+// Take a popped completion for delivery. A transfer freed while it was
+// queued is released instead.
+static bool claim_delivery(struct libusb_transfer* transfer) {
+    if (emscripten_atomic_cas_u32((void*)&tc(transfer)->delivery, DELIVERY_QUEUED, DELIVERY_RUNNING) ==
+        DELIVERY_QUEUED)
+        return true;
+
+    release_transfer(transfer);
+    return false;
+}
+
+// What is left to do with a transfer once its callback returned. It may have
+// been freed meanwhile, or resubmitted and completed again, in which case
+// its next delivery is already queued.
+static void after_callback(struct libusb_transfer* transfer) {
+    uint32_t state = emscripten_atomic_cas_u32((void*)&tc(transfer)->delivery, DELIVERY_RUNNING, DELIVERY_NONE);
+
+    if (state == (DELIVERY_RUNNING | DELIVERY_FREED))
+        release_transfer(transfer);
+    if (state != DELIVERY_RUNNING)
+        return;
+
+    if ((transfer->flags & LIBUSB_WEBUSB_TRANSFER_AUTO_RESUBMIT) &&
+        transfer->status == LIBUSB_TRANSFER_COMPLETED && !tc(transfer)->in_flight &&
+        !tc(transfer)->cancel_requested)
+        auto_resubmit(transfer);
+}
+
+// Completions of endpoints with a batch callback, collected during one
+// delivery pass, see libusb_webusb_set_batch_callback().
+static thread_local std::vector<struct libusb_transfer*> batched;
+
+static batch_callback* batch_callback_of(struct libusb_transfer* transfer) {
+    return hc(transfer->dev_handle)->batch[endpoint_index(transfer->endpoint)];
+}
+
+int LIBUSB_CALL _libusb_webusb_set_batch_callback(libusb_device_handle *dev_handle,
+    unsigned char endpoint, libusb_webusb_batch_cb_fn callback, void *user_data) {
+    handle_context* h = hc(dev_handle);
+    int index = endpoint_index(endpoint);
+
+    batch_callback* batch = callback ? new batch_callback{callback, user_data} : nullptr;
+    batch_callback* old = h->batch[index];
+    h->batch[index] = batch;
+
+    if (old)
+        h->retired.push_back(old);
+
+    return LIBUSB_SUCCESS;
+}
+
+// Hand each endpoint's completions to its batch callback in one call, in the
+// order they were submitted.
+static void deliver_batches(webusb_context* ctx, bool on_worker) {
+    std::stable_sort(batched.begin(), batched.end(), [](struct libusb_transfer* a, struct libusb_transfer* b) {
+        if (a->dev_handle != b->dev_handle)
+            return a->dev_handle < b->dev_handle;
+        if (a->endpoint != b->endpoint)
+            return a->endpoint < b->endpoint;
+        return (int32_t)(tc(a)->id - tc(b)->id) < 0;
+    });
+
+    for (size_t first = 0; first < batched.size();) {
+        size_t last = first + 1;
+        while (last < batched.size() && batched[last]->dev_handle == batched[first]->dev_handle &&
+               batched[last]->endpoint == batched[first]->endpoint)
+            last++;
+
+        batch_callback* batch = batch_callback_of(batched[first]);
+        double start = emscripten_get_now();
+
+        // The batch callback may have been unset since the pass began.
+        if (batch) {
+            batch->callback(&batched[first], last - first, batch->user_data);
+        } else {
+            for (size_t i = first; i < last; i++)
+                batched[i]->callback(batched[i]);
+        }
+
+        double end = emscripten_get_now();
+        for (size_t i = first; i < last; i++)
+            count_callback(ctx, start - tc(batched[i])->completed_at, i == first ? end - start : 0, on_worker);
+
+        for (size_t i = first; i < last; i++) {
+            handle_context* h = hc(batched[i]->dev_handle);
+            after_callback(batched[i]);
+            release_handle(h);
+        }
+
+        first = last;
+    }
+
+    batched.clear();
+}
+
+// Hand the completion ring to another consumer. Running on the worker, this
+// cannot overlap the worker's own deliveries.
+int _libusb_webusb_set_consumer(libusb_context *ctx, int consumer) {
+    webusb_context* context = (webusb_context*)ctx;
+
+    context->consumer = consumer;
+    signal_event(context);
+
+    return LIBUSB_SUCCESS;
+}
+
+// Runs on the context's worker, or on its callback thread if it has one,
+// see libusb_webusb_set_callback_thread(). Only the current consumer pops,
+// so the ring never has two of them.
 int LIBUSB_CALL _libusb_handle_events_timeout_completed(libusb_context *ctx,
 	struct timeval *tv, int *completed) {
-    {
-        std::lock_guard<std::mutex> lock(mutex);
-        std::move(staging.begin(), staging.end(), std::back_inserter(transfers));
-        staging.clear();
-    }
-
-    transfers.erase(
-    std::remove_if(transfers.begin(), transfers.end(),
-        [](struct libusb_transfer* transfer) {
-            if (transfer->status == LIBUSB_TRANSFER_COMPLETED ||
-                transfer->status == LIBUSB_TRANSFER_CANCELLED) {
-                transfer->callback(transfer);
-                return true;
-            }
-            return false;
-        }),
-    transfers.end());
+    webusb_context* context = (webusb_context*)ctx;
+    bool on_worker = pthread_equal(pthread_self(), context->worker);
+    int self = on_worker ? CONSUMER_WORKER : CONSUMER_CALLBACK_THREAD;
+    uint32_t delivered = 0;
+
+    struct libusb_transfer* transfer;
+    while (context->consumer == self && context->completions.pop(transfer)) {
+        context->outstanding--;
+        delivered++;
+
+        // The transfer's reference on its handle, taken by complete_transfer().
+        handle_context* h = hc(transfer->dev_handle);
+
+        if (!claim_delivery(transfer)) {
+            release_handle(h);
+            continue;
+        }
+
+        if (batch_callback_of(transfer)) {
+            batched.push_back(transfer);
+            continue;
+        }
+
+        double start = emscripten_get_now();
+        transfer->callback(transfer);
+        double end = emscripten_get_now();
+
+        count_callback(context, start - tc(transfer)->completed_at, end - start, on_worker);
+        after_callback(transfer);
+        release_handle(h);
+    }
+
+    if (!batched.empty())
+        deliver_batches(context, on_worker);
+
+    if (delivered) {
+        context->completions_delivered += delivered;
+        signal_event(context);
+    }
 
     return LIBUSB_SUCCESS;
 }